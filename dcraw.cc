@@ -40,6 +40,16 @@ extern "C" {
 #include <string.h>
 #include <time.h>
 #include <sys/types.h>
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#define uf_omp_get_max_threads() omp_get_max_threads()
+#else
+#define uf_omp_get_max_threads() 1
+#endif
 
 #ifndef HAVE_CONFIG_H /*fseeko() is handled by the UFRaw config system - NKBJ*/
 #if defined(DJGPP) || defined(__MINGW32__)
@@ -141,19 +151,33 @@ ifname_display = NULL;
 ifpReadCount = 0;
 ifpSize = 0;
 ifpStepProgress = 0;
+ifpProgressMark = 0;
 eofCount = 0;
+ifpDataStream = NULL;
+ifpData = NULL;
+ifpDataSize = ifpDataPos = 0;
+ifpDataEof = 0;
+ifpMapping = NULL;
+memset(&bitr, 0, sizeof bitr);
+ph1_bitbuf = 0, ph1_vbits = 0, pana_vbits = 0, sony_p = 0;
+crx_index = 0, crx_wide = crx_high = crx_off = crx_len = 0;
+idct_cs[0] = 0;
 }
 
 CLASS ~DCRaw()
 {
+ifpReleaseData();
 free(ifname);
 free(ifname_display);
 }
 
+/* ifpProgress() is called for every byte read by fgetc(). To keep that
+ * cheap, readers only call it once ifpReadCount reaches ifpProgressMark,
+ * the read count of the next progress step. */
 void CLASS ifpProgress(unsigned readCount) {
     ifpReadCount += readCount;
     if (ifpSize==0) return;
-    unsigned newStepProgress = STEPS * ifpReadCount / ifpSize;
+    unsigned newStepProgress = STEPS * (UINT64)ifpReadCount / ifpSize;
     if (newStepProgress > ifpStepProgress) {
 #ifdef DCRAW_NOMAIN
 	if (ifpStepProgress)
@@ -163,10 +187,94 @@ void CLASS ifpProgress(unsigned readCount) {
 #endif
     }
     ifpStepProgress = newStepProgress;
+    ifpProgressMark = ((UINT64)ifpStepProgress + 1) * ifpSize / STEPS;
+}
+
+/*
+ * Map the whole of ifp into memory. Raw decoders read the file mostly
+ * sequentially in small pieces, serving these reads from the mapping avoids
+ * the stdio locking and the read() calls. Returns 0 if the file cannot be
+ * mapped, in which case reads fall back to stdio.
+ */
+int CLASS ifpMap()
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    struct stat st;
+    void *map;
+
+    if (fstat(fileno(ifp), &st) != 0 || !S_ISREG(st.st_mode) ||
+	st.st_size <= 0 || (UINT64)st.st_size > (size_t)-1)
+	return 0;
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(ifp), 0);
+    if (map == MAP_FAILED)
+	return 0;
+#ifdef HAVE_MADVISE
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+#endif
+    ifpSetData(map, st.st_size);
+    ifpMapping = map;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/* Serve reads of ifp from a memory buffer which holds the file's content.
+ * The buffer must stay valid until ifpReleaseData() is called. */
+void CLASS ifpSetData(const void *data, size_t size)
+{
+    ifpReleaseData();
+    ifpDataStream = ifp;
+    ifpData = (const uchar *)data;
+    ifpDataSize = size;
+    ifpDataPos = 0;
+    ifpDataEof = 0;
+}
+
+void CLASS ifpReleaseData()
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+    if (ifpMapping != NULL)
+	munmap(ifpMapping, ifpDataSize);
+#endif
+    ifpMapping = NULL;
+    ifpDataStream = NULL;
+    ifpData = NULL;
+    ifpDataSize = ifpDataPos = 0;
+}
+
+/* Move the stdio position of the stream to the in-memory position, for
+ * code that reads the FILE directly (libjpeg, fscanf). */
+void CLASS ifpDataSync()
+{
+    ::fseek(ifpDataStream, ifpDataPos, SEEK_SET);
+}
+
+/* And back, after such code has read from the FILE. */
+void CLASS ifpDataResync()
+{
+    long pos = ::ftell(ifpDataStream);
+    if (pos >= 0) ifpDataPos = pos;
+    ifpDataEof = ::feof(ifpDataStream);
 }
 
 size_t CLASS fread(void *ptr, size_t size, size_t nmemb, FILE *stream) {
-    size_t num = ::fread(ptr, size, nmemb, stream);
+    size_t num;
+    if (bitr.active && stream == ifp) bitFlush(&bitr);
+    if (stream == ifpDataStream && ifpData) {
+	size_t avail = ifpDataPos < ifpDataSize ? ifpDataSize - ifpDataPos : 0;
+	num = size == 0 || nmemb <= avail / size ? nmemb : avail / size;
+	memcpy(ptr, ifpData + ifpDataPos, size*num);
+	ifpDataPos += size*num;
+	if (num != nmemb) {
+	    /* Like stdio, consume the partial trailing element. */
+	    memcpy((char *)ptr + size*num, ifpData + ifpDataPos,
+		    avail - size*num);
+	    ifpDataPos += avail - size*num;
+	    ifpDataEof = 1;
+	}
+    } else
+	num = ::fread(ptr, size, nmemb, stream);
     if ( num != nmemb ) {
         if (eofCount < 10)
             // Maybe this should be a DCRAW_WARNING
@@ -190,7 +298,14 @@ size_t CLASS fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream) {
 }
 
 char *CLASS fgets(char *s, int size, FILE *stream) {
-    char *str = ::fgets(s, size, stream);
+    char *str;
+    if (bitr.active && stream == ifp) bitFlush(&bitr);
+    if (stream == ifpDataStream && ifpData) {
+	ifpDataSync();
+	str = ::fgets(s, size, stream);
+	ifpDataResync();
+    } else
+	str = ::fgets(s, size, stream);
     if (str == NULL) {
         if (eofCount < 10)
             // Maybe this should be a DCRAW_WARNING
@@ -206,13 +321,77 @@ char *CLASS fgets(char *s, int size, FILE *stream) {
 }
 
 int CLASS fgetc(FILE *stream) {
-    int chr = ::fgetc(stream);
-    if (stream==ifp) ifpProgress(1);
+    int chr;
+    if (bitr.active && stream == ifp) bitFlush(&bitr);
+    if (stream == ifpDataStream && ifpData) {
+	if (ifpDataPos < ifpDataSize)
+	    chr = ifpData[ifpDataPos++];
+	else {
+	    ifpDataEof = 1;
+	    chr = EOF;
+	}
+    } else
+	chr = ::fgetc(stream);
+    if (stream==ifp && ++ifpReadCount >= ifpProgressMark) ifpProgress(0);
     return chr;
 }
 
+int CLASS fseek(FILE *stream, long offset, int whence) {
+    if (bitr.active && stream == ifp) bitFlush(&bitr);
+    if (stream == ifpDataStream && ifpData) {
+	long base = whence == SEEK_SET ? 0 :
+		    whence == SEEK_CUR ? (long)ifpDataPos : (long)ifpDataSize;
+	if (base + offset < 0) {
+	    errno = EINVAL;
+	    return -1;
+	}
+	/* Seeking past the end is allowed, reads there will fail. */
+	ifpDataPos = base + offset;
+	ifpDataEof = 0;
+	return 0;
+    }
+    return ::fseek(stream, offset, whence);
+}
+
+long CLASS ftell(FILE *stream) {
+    if (bitr.active && stream == ifp) bitFlush(&bitr);
+    if (stream == ifpDataStream && ifpData)
+	return ifpDataPos;
+    return ::ftell(stream);
+}
+
+#ifdef HAVE_FSEEKO
+int CLASS fseeko(FILE *stream, off_t offset, int whence) {
+    if (bitr.active && stream == ifp) bitFlush(&bitr);
+    if (stream == ifpDataStream && ifpData)
+	return fseek(stream, offset, whence);
+    return ::fseeko(stream, offset, whence);
+}
+
+off_t CLASS ftello(FILE *stream) {
+    if (bitr.active && stream == ifp) bitFlush(&bitr);
+    if (stream == ifpDataStream && ifpData)
+	return ifpDataPos;
+    return ::ftello(stream);
+}
+#endif
+
+int CLASS feof(FILE *stream) {
+    if (bitr.active && stream == ifp) bitFlush(&bitr);
+    if (stream == ifpDataStream && ifpData)
+	return ifpDataEof;
+    return ::feof(stream);
+}
+
 int CLASS fscanf(FILE *stream, const char *format, void *ptr) {
-    int count = ::fscanf(stream, format, ptr);
+    int count;
+    if (bitr.active && stream == ifp) bitFlush(&bitr);
+    if (stream == ifpDataStream && ifpData) {
+	ifpDataSync();
+	count = ::fscanf(stream, format, ptr);
+	ifpDataResync();
+    } else
+	count = ::fscanf(stream, format, ptr);
     if ( count != 1 )
         dcraw_message(DCRAW_WARNING, "%s: fscanf %d != 1\n",
                 ifname_display, count);
@@ -360,19 +539,51 @@ void CLASS merror (void *ptr, const char *where)
 
 void CLASS derror()
 {
-  if (!data_error) {
-    dcraw_message (DCRAW_WARNING, "%s: ", ifname_display);
-    if (feof(ifp))
-      dcraw_message (DCRAW_WARNING,_("Unexpected end of file\n"));
-    else
+#ifdef _OPENMP
+#pragma omp critical(derror)		/* tiles may be decoded in parallel */
+#endif
+  {
+    if (!data_error) {
+      dcraw_message (DCRAW_WARNING, "%s: ", ifname_display);
+      if ((bitr.eof && bitr.vbits < 0) || feof(ifp))
+	dcraw_message (DCRAW_WARNING,_("Unexpected end of file\n"));
+      else
 #ifdef HAVE_FSEEKO
-      dcraw_message (DCRAW_WARNING,_("Corrupt data near 0x%llx\n"),
-		(INT64) ftello(ifp));
+	dcraw_message (DCRAW_WARNING,_("Corrupt data near 0x%llx\n"),
+		  (INT64) ftello(ifp));
 #else
-      dcraw_message (DCRAW_WARNING,_("Corrupt data near 0x%lx\n"), ftell(ifp));
+	dcraw_message (DCRAW_WARNING,_("Corrupt data near 0x%lx\n"), ftell(ifp));
+#endif
+    }
+    data_error++;
+  }
+}
+
+/*
+   derror() for data read through br. A bit_reader over the mapping reports
+   its own position, since tiles may be decoded from it in parallel while
+   ifp and bitr belong to the thread which parses the headers.
+ */
+void CLASS derror (bit_reader *br)
+{
+  if (br->fromFile) {
+    derror();
+    return;
+  }
+#ifdef _OPENMP
+#pragma omp critical(derror)
 #endif
+  {
+    if (!data_error) {
+      dcraw_message (DCRAW_WARNING, "%s: ", ifname_display);
+      if (br->eof && br->vbits < 0)
+	dcraw_message (DCRAW_WARNING,_("Unexpected end of file\n"));
+      else
+	dcraw_message (DCRAW_WARNING,_("Corrupt data near 0x%llx\n"),
+		  (INT64) (br->ptr - ifpData));
+    }
+    data_error++;
   }
-  data_error++;
 }
 
 ushort CLASS sget2 (uchar *s)
@@ -677,32 +888,196 @@ int CLASS canon_s2is()
   return 0;
 }
 
-unsigned CLASS getbithuff (int nbits, ushort *huff)
+/*
+   getbithuff() used to read ifp one byte at a time through fgetc(),
+   keeping its state in static variables. The bit_reader keeps that state
+   per DCRaw instance and refills up to 64 bits at a time from memory.
+   Reads from ifp by other code first call bitFlush(), which gives back
+   the bytes the old reader would not have read yet.
+ */
+void CLASS bitStart (bit_reader *br)
+{
+  if (ifpData && ifpDataStream == ifp) {
+    br->start = br->ptr = ifpData + MIN(ifpDataPos, ifpDataSize);
+    br->end = ifpData + ifpDataSize;
+    br->fromFile = 0;
+  } else {
+#ifdef HAVE_FSEEKO
+    br->startOffset = ::ftello(ifp);
+#else
+    br->startOffset = ::ftell(ifp);
+#endif
+    br->start = br->ptr = br->end = br->block;
+    br->fromFile = 1;
+  }
+  br->active = 1;
+  br->eof = 0;
+}
+
+int CLASS bitRefillBlock (bit_reader *br)
+{
+  size_t keep, num;
+
+  if (!br->fromFile) return 0;
+  /* Keep a tail for bitFlush() to step back into. */
+  keep = MIN(br->end - br->start, 32);
+  memmove (br->block, br->end - keep, keep);
+  br->startOffset += (br->end - br->start) - keep;
+  num = ::fread (br->block + keep, 1, sizeof br->block - keep, ifp);
+  if (br == &bitr) ifpProgress(num);
+  br->start = br->block;
+  br->ptr = br->block + keep;
+  br->end = br->ptr + num;
+  return num > 0;
+}
+
+void CLASS bitFill (bit_reader *br)
+{
+  const uchar *bp;
+  unsigned c;
+  int n;
+
+  if (!br->active) bitStart (br);
+  bp = br->ptr;
+  while (br->vbits <= 56 && !br->reset) {
+    n = (64 - br->vbits) >> 3;
+    if (br->end - bp >= n && !(zero_after_ff && memchr (bp, 0xff, n))) {
+      /* No stuffed bytes, take them all at once. */
+      for (; n--; br->vbits += 8)
+	br->bitbuf = (br->bitbuf << 8) | *bp++;
+      break;
+    }
+    if (bp == br->end) {
+      br->ptr = bp;
+      n = bitRefillBlock (br);
+      bp = br->ptr;
+      if (!n) {
+	br->eof = 1;
+	break;
+      }
+    }
+    c = *bp++;
+    if (zero_after_ff && c == 0xff) {
+      if (bp == br->end) {
+	br->ptr = bp;
+	n = bitRefillBlock (br);
+	bp = br->ptr;
+	if (!n) {
+	  br->reset = br->eof = 1;	/* fgetc() returned EOF after 0xff */
+	  br->markerLen = 1;
+	  break;
+	}
+      }
+      if (*bp++) {
+	br->reset = 1;
+	br->markerLen = 2;
+	break;
+      }
+    }
+    br->bitbuf = (br->bitbuf << 8) | c;
+    br->vbits += 8;
+  }
+  if (br == &bitr && !br->fromFile) {
+    ifpReadCount += bp - br->ptr;
+    if (ifpReadCount >= ifpProgressMark) ifpProgress(0);
+  }
+  br->ptr = bp;
+}
+
+void CLASS bitFlush (bit_reader *br)
+{
+  const uchar *bp = br->ptr;
+  int give = (br->vbits - br->lazyBits) >> 3, n;
+
+  if (!br->active) return;
+  if (br->reset && !br->lazyMarker) {
+    bp -= br->markerLen;
+    br->reset = 0;
+  }
+  while (give-- > 0)
+    bp -= zero_after_ff && bp - br->start >= 2 &&
+	  bp[-1] == 0 && bp[-2] == 0xff ? 2 : 1;
+  if (br->vbits > br->lazyBits) {
+    n = br->vbits - br->lazyBits;
+    br->bitbuf = n < 64 ? br->bitbuf >> n : 0;
+    br->vbits = br->lazyBits;
+  }
+  if (br != &bitr) {		/* private readers keep their own cursor */
+    br->ptr = bp;
+    return;
+  }
+  if (br->fromFile)
+#ifdef HAVE_FSEEKO
+    ::fseeko (ifp, br->startOffset + (bp - br->start), SEEK_SET);
+#else
+    ::fseek (ifp, br->startOffset + (bp - br->start), SEEK_SET);
+#endif
+  else
+    ifpDataPos += bp - br->start;
+  if (br->lazyEof) {		/* the old reader got EOF from fgetc() */
+    if (br->fromFile) ::fgetc (ifp);
+    else ifpDataEof = 1;
+    br->lazyEof = 0;
+  }
+  br->active = 0;
+}
+
+unsigned CLASS getbithuff (bit_reader *br, int nbits, ushort *huff)
 {
-  // TODO: The following static variables are not thread-safe
-  static unsigned bitbuf=0;
-  static int vbits=0, reset=0;
   unsigned c;
+  int need;
 
   if (nbits > 25) return 0;
-  if (nbits < 0)
-    return bitbuf = vbits = reset = 0;
-  if (nbits == 0 || vbits < 0) return 0;
-  while (!reset && vbits < nbits && (c = fgetc(ifp)) != (unsigned) EOF &&
-    !(reset = zero_after_ff && c == 0xff && fgetc(ifp))) {
-    bitbuf = (bitbuf << 8) + (uchar) c;
-    vbits += 8;
-  }
-  c = bitbuf << (32-vbits) >> (32-nbits);
+  if (nbits < 0) {
+    bitFlush (br);
+    br->bitbuf = br->vbits = br->reset = 0;
+    br->lazyBits = br->lazyMarker = br->lazyEof = 0;
+    return 0;
+  }
+  if (nbits == 0 || br->vbits < 0) return 0;
+  if (br->vbits < nbits) bitFill (br);
+  if (br->lazyBits < nbits) {
+    need = (nbits - br->lazyBits + 7) & ~7;
+    if (need > br->vbits - br->lazyBits) {
+      need = br->vbits - br->lazyBits;
+      if (br->reset) br->lazyMarker = 1;
+      if (br->eof) br->lazyEof = 1;
+    }
+    br->lazyBits += need;
+  }
+  c = br->vbits > 0 ? br->bitbuf << (64-br->vbits) >> (64-nbits) : 0;
   if (huff) {
-    vbits -= huff[c] >> 8;
+    br->vbits -= huff[c] >> 8;
+    br->lazyBits -= huff[c] >> 8;
     c = (uchar) huff[c];
-  } else
-    vbits -= nbits;
-  if (vbits < 0) derror();
+  } else {
+    br->vbits -= nbits;
+    br->lazyBits -= nbits;
+  }
+  if (br->vbits < 0) derror(br);
   return c;
 }
 
+/*
+   Step back over the last two bytes read and skip past the next
+   restart marker, as lossless JPEG does between restart intervals.
+ */
+void CLASS bitSkipMarker (bit_reader *br)
+{
+  ushort mark=0;
+  int c;
+
+  if (br == &bitr) {
+    fseek (ifp, -2, SEEK_CUR);
+    do mark = (mark << 8) + (c = fgetc(ifp));
+    while (c != EOF && mark >> 4 != 0xffd);
+    return;
+  }
+  bitFlush (br);
+  br->ptr -= MIN(br->ptr - br->start, 2);
+  while (br->ptr < br->end && (mark = (mark << 8) + *br->ptr++) >> 4 != 0xffd);
+}
+
 #define getbits(n) getbithuff(n,0)
 #define gethuff(h) getbithuff(*h,h+1)
 
@@ -897,6 +1272,7 @@ void CLASS canon_load_raw()
 struct jhead {
   int algo, bits, high, wide, clrs, sraw, psv, restart, vpred[6];
   ushort quant[64], idct[64], *huff[20], *free[20], *row;
+  DCRaw::bit_reader *br;
 };
 
 int CLASS ljpeg_start (struct jhead *jh, int info_only)
@@ -907,6 +1283,7 @@ int CLASS ljpeg_start (struct jhead *jh, int info_only)
 
   memset (jh, 0, sizeof *jh);
   jh->restart = INT_MAX;
+  jh->br = &bitr;
   if ((fgetc(ifp),fgetc(ifp)) != 0xd8) return 0;
   do {
     if (!fread (data, 2, 2, ifp)) return 0;
@@ -964,17 +1341,17 @@ void CLASS ljpeg_end (struct jhead *jh)
   free (jh->row);
 }
 
-int CLASS ljpeg_diff (ushort *huff)
+int CLASS ljpeg_diff (bit_reader *br, ushort *huff)
 {
   int len, diff;
 
   if (!huff)
     longjmp(failure, 2);
 
-  len = gethuff(huff);
+  len = getbithuff(br, *huff, huff+1);
   if (len == 16 && (!dng_version || dng_version >= 0x1010000))
     return -32768;
-  diff = getbits(len);
+  diff = getbithuff(br, len, 0);
   if ((diff & (1 << (len-1))) == 0)
     diff -= (1 << len) - 1;
   return diff;
@@ -983,21 +1360,17 @@ int CLASS ljpeg_diff (ushort *huff)
 ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
 {
   int col, c, diff, pred, spred=0;
-  ushort mark=0, *row[3];
+  ushort *row[3];
 
   if (jrow * jh->wide % jh->restart == 0) {
     FORC(6) jh->vpred[c] = 1 << (jh->bits-1);
-    if (jrow) {
-      fseek (ifp, -2, SEEK_CUR);
-      do mark = (mark << 8) + (c = fgetc(ifp));
-      while (c != EOF && mark >> 4 != 0xffd);
-    }
-    getbits(-1);
+    if (jrow) bitSkipMarker (jh->br);
+    getbithuff (jh->br, -1, 0);
   }
   FORC3 row[c] = jh->row + jh->wide*jh->clrs*((jrow+c) & 1);
   for (col=0; col < jh->wide; col++)
     FORC(jh->clrs) {
-      diff = ljpeg_diff (jh->huff[c]);
+      diff = ljpeg_diff (jh->br, jh->huff[c]);
       if (jh->sraw && c <= jh->sraw && (col | c))
 		    pred = spred;
       else if (col) pred = row[0][-jh->clrs];
@@ -1012,7 +1385,7 @@ ushort * CLASS ljpeg_row (int jrow, struct jhead *jh)
 	case 7: pred = (pred + row[1][0]) >> 1;				break;
 	default: pred = 0;
       }
-      if ((**row = pred + diff) >> jh->bits) derror();
+      if ((**row = pred + diff) >> jh->bits) derror(jh->br);
       if (c <= jh->sraw) spred = **row;
       row[0]++; row[1]++;
     }
@@ -1151,7 +1524,7 @@ void CLASS ljpeg_idct (struct jhead *jh)
 {
   int c, i, j, len, skip, coef;
   float work[3][8][8];
-  static float cs[106] = { 0 };
+  float *cs = idct_cs;
   static const uchar zigzag[80] =
   {  0, 1, 8,16, 9, 2, 3,10,17,24,32,25,18,11, 4, 5,12,19,26,33,
     40,48,41,34,27,20,13, 6, 7,14,21,28,35,42,49,56,57,50,43,36,
@@ -1161,12 +1534,13 @@ void CLASS ljpeg_idct (struct jhead *jh)
   if (!cs[0])
     FORC(106) cs[c] = cos((c & 31)*M_PI/16)/2;
   memset (work, 0, sizeof work);
-  work[0][0][0] = jh->vpred[0] += ljpeg_diff (jh->huff[0]) * jh->quant[0];
+  work[0][0][0] = jh->vpred[0] +=
+	ljpeg_diff (jh->br, jh->huff[0]) * jh->quant[0];
   for (i=1; i < 64; i++ ) {
-    len = gethuff (jh->huff[16]);
+    len = getbithuff (jh->br, *jh->huff[16], jh->huff[16]+1);
     i += skip = len >> 4;
     if (!(len &= 15) && skip < 15) break;
-    coef = getbits(len);
+    coef = getbithuff (jh->br, len, 0);
     if ((coef & (1 << (len-1))) == 0)
       coef -= (1 << len) - 1;
     ((float *)work)[zigzag[i]] = coef * jh->quant[i];
@@ -1183,46 +1557,107 @@ void CLASS ljpeg_idct (struct jhead *jh)
   FORC(64) jh->idct[c] = CLIP(((float *)work[2])[c]+0.5);
 }
 
+void CLASS lossless_dng_tile (struct jhead *jh, unsigned trow, unsigned tcol)
+{
+  unsigned jwide, jrow, jcol, row, col, i, j;
+  ushort *rp;
+
+  jwide = jh->wide;
+  if (filters) jwide *= jh->clrs;
+  jwide /= MIN (is_raw, tiff_samples);
+  switch (jh->algo) {
+    case 0xc1:
+      jh->vpred[0] = 16384;
+      getbithuff (jh->br, -1, 0);
+      for (jrow=0; jrow+7 < (unsigned) jh->high; jrow += 8) {
+	for (jcol=0; jcol+7 < (unsigned) jh->wide; jcol += 8) {
+	  ljpeg_idct (jh);
+	  rp = jh->idct;
+	  row = trow + jcol/tile_width + jrow*2;
+	  col = tcol + jcol%tile_width;
+	  for (i=0; i < 16; i+=2)
+	    for (j=0; j < 8; j++)
+	      adobe_copy_pixel (row+i, col+j, &rp);
+	}
+      }
+      break;
+    case 0xc3:
+      for (row=col=jrow=0; jrow < (unsigned) jh->high; jrow++) {
+	rp = ljpeg_row (jrow, jh);
+	for (jcol=0; jcol < jwide; jcol++) {
+	  adobe_copy_pixel (trow+row, tcol+col, &rp);
+	  if (++col >= tile_width || col >= raw_width)
+	    row += 1 + (col = 0);
+	}
+      }
+  }
+}
+
+/*
+   Tiles are compressed independently. When ifp is mapped, parse a batch
+   of tile headers here and decode the batch in parallel, each tile with
+   its own bit_reader over the mapping. Headers are parsed serially since
+   ljpeg_start() may longjmp(). Errors in a tile are reported with
+   derror(br).
+ */
+void CLASS lossless_dng_load_tiles()
+{
+  struct jhead *jh;
+  bit_reader *br;
+  unsigned *tpos, save, trow=0, tcol=0;
+  int nbatch, n, i, serial;
+
+  nbatch = uf_omp_get_max_threads() * 2;
+  jh = (struct jhead *) calloc (nbatch, sizeof *jh + sizeof *br + 2*sizeof *tpos);
+  merror (jh, "lossless_dng_load_tiles()");
+  br = (bit_reader *) (jh + nbatch);
+  tpos = (unsigned *) (br + nbatch);
+  while (trow < raw_height) {
+    for (serial=n=0; n < nbatch && trow < raw_height; n++) {
+      save = ftell(ifp);
+      fseek (ifp, get4(), SEEK_SET);
+      if (!ljpeg_start (&jh[n], 0)) {
+	trow = raw_height;
+	break;
+      }
+      memset (&br[n], 0, sizeof br[n]);
+      bitStart (jh[n].br = &br[n]);
+      if (jh[n].algo != 0xc3) serial = 1;	/* ljpeg_idct() is not reentrant */
+      tpos[n*2] = trow;
+      tpos[n*2+1] = tcol;
+      fseek (ifp, save+4, SEEK_SET);
+      if ((tcol += tile_width) >= raw_width)
+	trow += tile_length + (tcol = 0);
+    }
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) if (!serial)
+#endif
+    for (i=0; i < n; i++)
+      lossless_dng_tile (&jh[i], tpos[i*2], tpos[i*2+1]);
+    for (i=0; i < n; i++) {
+      ifpProgress (br[i].ptr - br[i].start);
+      ljpeg_end (&jh[i]);
+    }
+  }
+  free (jh);
+}
+
 void CLASS lossless_dng_load_raw()
 {
-  unsigned save, trow=0, tcol=0, jwide, jrow, jcol, row, col, i, j;
+  unsigned save, trow=0, tcol=0;
   struct jhead jh;
-  ushort *rp;
 
+  if (ifpData && ifpDataStream == ifp && tile_length < INT_MAX &&
+	uf_omp_get_max_threads() > 1) {
+    lossless_dng_load_tiles();
+    return;
+  }
   while (trow < raw_height) {
     save = ftell(ifp);
     if (tile_length < INT_MAX)
       fseek (ifp, get4(), SEEK_SET);
     if (!ljpeg_start (&jh, 0)) break;
-    jwide = jh.wide;
-    if (filters) jwide *= jh.clrs;
-    jwide /= MIN (is_raw, tiff_samples);
-    switch (jh.algo) {
-      case 0xc1:
-	jh.vpred[0] = 16384;
-	getbits(-1);
-	for (jrow=0; jrow+7 < (unsigned) jh.high; jrow += 8) {
-	  for (jcol=0; jcol+7 < (unsigned) jh.wide; jcol += 8) {
-	    ljpeg_idct (&jh);
-	    rp = jh.idct;
-	    row = trow + jcol/tile_width + jrow*2;
-	    col = tcol + jcol%tile_width;
-	    for (i=0; i < 16; i+=2)
-	      for (j=0; j < 8; j++)
-		adobe_copy_pixel (row+i, col+j, &rp);
-	  }
-	}
-	break;
-      case 0xc3:
-	for (row=col=jrow=0; jrow < (unsigned) jh.high; jrow++) {
-	  rp = ljpeg_row (jrow, &jh);
-	  for (jcol=0; jcol < jwide; jcol++) {
-	    adobe_copy_pixel (trow+row, tcol+col, &rp);
-	    if (++col >= tile_width || col >= raw_width)
-	      row += 1 + (col = 0);
-	  }
-	}
-    }
+    lossless_dng_tile (&jh, trow, tcol);
     fseek (ifp, save+4, SEEK_SET);
     if ((tcol += tile_width) >= raw_width)
       trow += tile_length + (tcol = 0);
@@ -1801,9 +2236,8 @@ void CLASS phase_one_load_raw()
 
 unsigned CLASS ph1_bithuff (int nbits, ushort *huff)
 {
-  // TODO: The following static variables are not thread-safe
-  static UINT64 bitbuf=0;
-  static int vbits=0;
+  UINT64 &bitbuf = ph1_bitbuf;
+  int &vbits = ph1_vbits;
   unsigned c;
 
   if (nbits == -1)
@@ -2103,8 +2537,8 @@ void CLASS canon_rmf_load_raw()
 
 unsigned CLASS pana_bits (int nbits)
 {
-  static uchar buf[0x4000];
-  static int vbits;
+  uchar *buf = pana_buf;
+  int &vbits = pana_vbits;
   int byte;
 
   if (!nbits) return vbits=0;
@@ -2401,12 +2835,11 @@ void CLASS lossy_dng_load_raw() {}
 METHODDEF(boolean)
 fill_input_buffer (j_decompress_ptr cinfo)
 {
-  // TODO: The following static variable is not thread-safe
-  static uchar jpeg_buffer[4096];
   size_t nbytes;
   DCRaw *d = (DCRaw*)cinfo->client_data;
+  uchar *jpeg_buffer = d->jpeg_buffer;
 
-  nbytes = fread (jpeg_buffer, 1, 4096, d->ifp);
+  nbytes = d->fread (jpeg_buffer, 1, 4096, d->ifp);
 #if defined(__MINGW64_VERSION_MAJOR) && __MINGW64_VERSION_MAJOR < 4
   swab ((char *) jpeg_buffer, (char *) jpeg_buffer, nbytes);
 #else
@@ -2502,6 +2935,7 @@ void CLASS lossy_dng_load_raw()
     fseek (ifp, save+=4, SEEK_SET);
     if (tile_length < INT_MAX)
       fseek (ifp, get4(), SEEK_SET);
+    if (ifpData) ifpDataSync();	/* libjpeg reads ifp directly - UF */
     jpeg_stdio_src (&cinfo, ifp);
     jpeg_read_header (&cinfo, boolean(TRUE));
     jpeg_start_decompress (&cinfo);
@@ -2764,8 +3198,7 @@ void CLASS kodak_thumb_load_raw()
 
 void CLASS sony_decrypt (unsigned *data, int len, int start, int key)
 {
-  // TODO: The following static variables are not thread-safe
-  static unsigned pad[128], p;
+  unsigned *pad = sony_pad, &p = sony_p;
 
   if (start) {
     for (p=0; p < 4; p++)
@@ -3164,8 +3597,7 @@ void CLASS redcine_load_raw()
 
 void CLASS foveon_decoder (int size, unsigned code)
 {
-  // TODO: The following static variable is not thread-safe
-  static unsigned huff[1024];
+  unsigned *huff = foveon_decode_huff;
   struct decode *cur;
   int i, len;
 
@@ -7270,7 +7702,8 @@ void CLASS parse_riff()
 void CLASS parse_crx (int end)
 {
   unsigned i, save, size, tag, base;
-  static int index=0, wide, high, off, len;
+  int &index = crx_index, &wide = crx_wide, &high = crx_high;
+  int &off = crx_off, &len = crx_len;
 
   order = 0x4d4d;
   while (ftell(ifp)+7 < end) {
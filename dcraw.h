@@ -92,6 +92,31 @@ public:
         float tag_210;
     } ph1;
 
+    /* State of getbithuff(). Bytes are taken in blocks from ifp, or
+     * directly from ifpData, and are accumulated 64 bits at a time.
+     * lazyBits counts the bits the original byte-at-a-time reader would
+     * have buffered, so that bitFlush() can give back the bytes which were
+     * read ahead before anyone else reads from ifp. */
+    struct bit_reader {
+        unsigned long long bitbuf;
+        int vbits, reset, lazyBits, lazyMarker, lazyEof, markerLen;
+        int active, fromFile, eof;
+        const uchar *start, *ptr, *end;
+        off_t startOffset;
+        uchar block[4096];
+    } bitr;
+
+    /* Decoder state which dcraw keeps in static variables. */
+    unsigned long long ph1_bitbuf;
+    int ph1_vbits;
+    uchar pana_buf[0x4000];
+    int pana_vbits;
+    uchar jpeg_buffer[4096];
+    unsigned sony_pad[128], sony_p;
+    unsigned foveon_decode_huff[1024];
+    int crx_index, crx_wide, crx_high, crx_off, crx_len;
+    float idct_cs[106];
+
     int tone_curve_size, tone_curve_offset; /* Nikon Tone Curves UF*/
     int tone_mode_offset, tone_mode_size; /* Nikon ToneComp UF*/
 
@@ -103,13 +128,37 @@ public:
     unsigned ifpSize;
     unsigned ifpStepProgress;
     int eofCount;
+    unsigned ifpProgressMark;
 #define STEPS 50
     void ifpProgress(unsigned readCount);
+    /* In-memory view of ifp. When ifpData is set, reads from ifpDataStream
+     * are served from memory and the stdio position of the stream is only
+     * synchronized when some library needs to read it directly. */
+    FILE *ifpDataStream;
+    const uchar *ifpData;
+    size_t ifpDataSize, ifpDataPos;
+    int ifpDataEof;
+    void *ifpMapping;
+    int ifpMap();
+    void ifpSetData(const void *data, size_t size);
+    void ifpReleaseData();
+    void ifpDataSync();
+    void ifpDataResync();
 // Override standard io function for integrity checks and progress report
     size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream);
     size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream);
     char *fgets(char *s, int size, FILE *stream);
     int fgetc(FILE *stream);
+    int getc(FILE *stream) {
+        return fgetc(stream);
+    }
+    int fseek(FILE *stream, long offset, int whence);
+    long ftell(FILE *stream);
+#ifdef HAVE_FSEEKO
+    int fseeko(FILE *stream, off_t offset, int whence);
+    off_t ftello(FILE *stream);
+#endif
+    int feof(FILE *stream);
 // dcraw only calls fscanf for single variables
     int fscanf(FILE *stream, const char *format, void *ptr);
 // calling with more variables would triger a link error
@@ -123,6 +172,7 @@ public:
     int fcol(int row, int col);
     void merror(void *ptr, const char *where);
     void derror();
+    void derror(bit_reader *br);
     ushort sget2(uchar *s);
     ushort get2();
     unsigned sget4(uchar *s);
@@ -139,7 +189,15 @@ public:
     void canon_600_load_raw();
     void canon_600_correct();
     int canon_s2is();
-    unsigned getbithuff(int nbits, ushort *huff);
+    void bitStart(bit_reader *br);
+    int bitRefillBlock(bit_reader *br);
+    void bitFill(bit_reader *br);
+    void bitFlush(bit_reader *br);
+    unsigned getbithuff(bit_reader *br, int nbits, ushort *huff);
+    unsigned getbithuff(int nbits, ushort *huff) {
+        return getbithuff(&bitr, nbits, huff);
+    }
+    void bitSkipMarker(bit_reader *br);
     ushort * make_decoder_ref(const uchar **source);
     ushort * make_decoder(const uchar *source);
     void crw_init_tables(unsigned table, ushort *huff[2]);
@@ -147,12 +205,17 @@ public:
     void canon_load_raw();
     int ljpeg_start(struct jhead *jh, int info_only);
     void ljpeg_end(struct jhead *jh);
-    int ljpeg_diff(ushort *huff);
+    int ljpeg_diff(bit_reader *br, ushort *huff);
+    int ljpeg_diff(ushort *huff) {
+        return ljpeg_diff(&bitr, huff);
+    }
     ushort * ljpeg_row(int jrow, struct jhead *jh);
     void lossless_jpeg_load_raw();
     void canon_sraw_load_raw();
     void adobe_copy_pixel(unsigned row, unsigned col, ushort **rp);
     void ljpeg_idct(struct jhead *jh);
+    void lossless_dng_tile(struct jhead *jh, unsigned trow, unsigned tcol);
+    void lossless_dng_load_tiles();
     void lossless_dng_load_raw();
     void packed_dng_load_raw();
     void pentax_load_raw();
@@ -29,6 +29,9 @@
 #include <sys/types.h>
 #include "dcraw_api.h"
 #include "dcraw.h"
+extern "C" {
+#include "uf_progress.h"
+}
 
 #define FORC(cnt) for (c=0; c < cnt; c++)
 #define FORC3 FORC(3)
@@ -73,6 +76,15 @@ extern "C" {
                           int *fuji_width_p, const int colors, const double step, void *dcraw);
 
     int dcraw_open(dcraw_data *h, char *filename)
+    {
+        return dcraw_open_buffer(h, filename, NULL, 0);
+    }
+
+    /* Open a raw file whose content is already in memory, as it is for
+     * decompressed .gz and .bz2 files. filename is only used for messages.
+     * The buffer must stay valid until dcraw_close(). */
+    int dcraw_open_buffer(dcraw_data *h, char *filename,
+                          const void *buffer, size_t size)
     {
         DCRaw *d = new DCRaw;
         int c, i;
@@ -92,7 +104,25 @@ extern "C" {
             delete d;
             return DCRAW_ERROR;
         }
-        if (!(d->ifp = g_fopen(d->ifname, "rb"))) {
+        if (buffer != NULL) {
+            /* A stdio stream of the same data is still needed by the few
+             * readers which bypass DCRaw's fread() and friends. */
+#ifdef HAVE_FMEMOPEN
+            d->ifp = fmemopen(const_cast<void *>(buffer), size, "rb");
+#else
+            if ((d->ifp = tmpfile()) != NULL) {
+                if (fwrite(buffer, 1, size, d->ifp) == size) {
+                    rewind(d->ifp);
+                } else {
+                    fclose(d->ifp);
+                    d->ifp = NULL;
+                }
+            }
+#endif
+        } else {
+            d->ifp = g_fopen(d->ifname, "rb");
+        }
+        if (d->ifp == NULL) {
             gchar *err_u8 = g_locale_to_utf8(strerror(errno), -1, NULL, NULL, NULL);
             d->dcraw_message(DCRAW_OPEN_ERROR, _("Cannot open file %s: %s\n"),
                              d->ifname_display, err_u8);
@@ -101,6 +131,12 @@ extern "C" {
             delete d;
             return DCRAW_OPEN_ERROR;
         }
+        /* Serve the decoders' reads from a memory mapping when possible.
+         * On failure dcraw simply keeps reading through stdio. */
+        if (buffer != NULL)
+            d->ifpSetData(buffer, size);
+        else
+            d->ifpMap();
         d->identify();
         /* We first check if dcraw recognizes the file, this is equivalent
          * to 'dcraw -i' succeeding */
@@ -347,6 +383,13 @@ extern "C" {
         DCRaw * volatile d = (DCRaw *)h->dcraw;
         int c, i, j;
         double dmin;
+        /* Shots already read by the multishot support below. They are kept
+         * here rather than in statics, so that several images can be
+         * loaded at the same time. */
+        dcraw_image_type * volatile tmp = NULL;
+        int volatile saved_fuji_dr = 0;
+        float saved_cam_mul[4];
+        guint16 * volatile saved_raw_image = NULL;
 
 start:
         g_free(d->messageBuffer);
@@ -356,6 +399,8 @@ start:
         if (setjmp(d->failure)) {
             d->dcraw_message(DCRAW_ERROR, _("Fatal internal error\n"));
             h->message = d->messageBuffer;
+            g_free(tmp);
+            free(saved_raw_image);
             delete d;
             return DCRAW_ERROR;
         }
@@ -364,10 +409,10 @@ start:
         h->raw.colors = d->colors;
         h->fourColorFilters = d->filters;
         if (d->filters || d->colors == 1) {
-            if (d->colors == 1 || d->filters == 1 || d->filters > 1000)
-                d->raw_image = (ushort *) g_malloc((d->raw_height + 7) * d->raw_width * 2);
-            else
-                d->raw_image = (ushort *) g_malloc(sizeof(dcraw_image_type) * (d->raw_height + 7) * d->raw_width);
+            /* One value per photosite for every CFA, X-Trans included.
+             * It is expanded to dcraw_image_type only after loading. */
+            d->raw_image = (ushort *) g_malloc((size_t)(d->raw_height + 7) *
+                                               d->raw_width * sizeof(ushort));
         } else {
             h->raw.image = d->image = g_new0(dcraw_image_type, d->iheight * d->iwidth
                                              + d->meta_length);
@@ -375,9 +420,9 @@ start:
         }
         d->dcraw_message(DCRAW_VERBOSE, _("Loading %s %s image from %s ...\n"),
                          d->make, d->model, d->ifname_display);
-        fseek(d->ifp, 0, SEEK_END);
-        d->ifpSize = ftell(d->ifp);
-        fseek(d->ifp, d->data_offset, SEEK_SET);
+        d->fseek(d->ifp, 0, SEEK_END);
+        d->ifpSize = d->ftell(d->ifp);
+        d->fseek(d->ifp, d->data_offset, SEEK_SET);
         (d->*d->load_raw)();
 
         /* multishot support, for now Pentax only. */
@@ -385,7 +430,6 @@ start:
 
             int row, col, i;
             int positions[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
-            static dcraw_image_type *tmp = NULL;
 
             if (!tmp)
                 tmp = d->image = g_new0(dcraw_image_type, d->height * d->width + d->meta_length);
@@ -402,7 +446,7 @@ start:
 
             if (d->shot_select < 3) {
                 d->shot_select++;
-                fseek(d->ifp, 0, SEEK_SET);
+                d->fseek(d->ifp, 0, SEEK_SET);
                 d->identify();
                 goto start;
             }
@@ -431,10 +475,6 @@ start:
         /* Fuji Super CCD SR and EXR support */
         if (d->is_raw == 2 && !strncasecmp(d->make, "Fujifilm", 8)) {
 
-            static int saved_fuji_dr;
-            static float saved_cam_mul[4];
-            static guint16 *saved_raw_image = NULL;
-
             if (!saved_raw_image) {
 
                 saved_raw_image = d->raw_image;
@@ -443,7 +483,7 @@ start:
                 FORC4 saved_cam_mul[c] = d->cam_mul[c];
 
                 d->shot_select++;
-                fseek(d->ifp, 0, SEEK_SET);
+                d->fseek(d->ifp, 0, SEEK_SET);
                 d->identify();
                 goto start;
             }
@@ -484,6 +524,7 @@ start:
             h->raw.width = h->width = d->width;
             h->raw.height = h->height = d->height;
         }
+        d->ifpReleaseData();
         fclose(d->ifp);
         h->ifp = NULL;
         // TODO: Go over the following settings to see if they change during
@@ -888,22 +929,19 @@ start:
     /*
      * Do black level adjustment, dark frame subtraction and white balance
      * (plus normalization to use the full 16 bit pixel value range) in one
-     * pass.
+     * pass over the rows first to last - 1 of the raw image.
+     * rgbWB[3] must already be set, see dcraw_finalize_raw().
      *
      * TODO: recode and optimize dark frame path
      */
-    void dcraw_finalize_raw(dcraw_data *h, dcraw_data *dark, int rgbWB[4])
+    void dcraw_finalize_raw_rows(dcraw_data *h, dcraw_data *dark,
+                                 const int rgbWB[4], int first, int last)
     {
         const int pixels = h->raw.width * h->raw.height;
         const unsigned black = dark ? MAX(h->black - dark->black, 0) : h->black;
-        if (h->colors == 3)
-            rgbWB[3] = rgbWB[1];
+        const int end = last * h->raw.width;
         if (dark) {
-#ifdef _OPENMP
-            #pragma omp parallel for schedule(static) \
-            shared(h,dark,rgbWB)
-#endif
-            for (int i = 0; i < pixels; i++) {
+            for (int i = first * h->raw.width; i < end; i++) {
                 int cc;
                 for (cc = 0; cc < 4; cc++) {
                     gint32 p = (gint64)(get_pixel(h, dark, i, cc, pixels) - black) *
@@ -912,11 +950,7 @@ start:
                 }
             }
         } else {
-#ifdef _OPENMP
-            #pragma omp parallel for schedule(static) \
-            shared(h,dark,rgbWB)
-#endif
-            for (int i = 0; i < pixels; i++) {
+            for (int i = first * h->raw.width; i < end; i++) {
                 int cc;
                 for (cc = 0; cc < 4; cc++)
                     h->raw.image[i][cc] = MIN(MAX(
@@ -926,6 +960,18 @@ start:
         }
     }
 
+    void dcraw_finalize_raw(dcraw_data *h, dcraw_data *dark, int rgbWB[4])
+    {
+        if (h->colors == 3)
+            rgbWB[3] = rgbWB[1];
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static) \
+        shared(h,dark,rgbWB)
+#endif
+        for (int row = 0; row < h->raw.height; row++)
+            dcraw_finalize_raw_rows(h, dark, rgbWB, row, row + 1);
+    }
+
     int dcraw_finalize_interpolate(dcraw_image_data *f, dcraw_data *h,
                                    int interpolation, int smoothing)
     {
@@ -976,6 +1022,8 @@ start:
         } else
             memcpy(f->image, h->raw.image, h->height * h->width * sizeof(dcraw_image_type));
         int smoothPasses = 1;
+        size_t size = f->height * f->width * sizeof(dcraw_image_type);
+        ufraw_timing_begin(TIMING_INTERPOLATE);
         if (interpolation == dcraw_bilinear_interpolation && (h->filters == 1 || h->filters > 1000))
             lin_interpolate_INDI(f->image, ff, f->width, f->height, cl, d, h);
 #ifdef ENABLE_INTERP_NONE
@@ -996,8 +1044,12 @@ start:
                                  h->rgb_cam, d, h);
             smoothPasses = 3;
         }
-        if (smoothing)
+        ufraw_timing_end(TIMING_INTERPOLATE, size);
+        if (smoothing) {
+            ufraw_timing_begin(TIMING_SMOOTH);
             color_smooth(f->image, f->width, f->height, smoothPasses);
+            ufraw_timing_end(TIMING_SMOOTH, size);
+        }
 
         if (cl == 4 && h->colors == 3) {
             for (i = 0; i < f->height * f->width; i++)
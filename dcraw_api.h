@@ -58,6 +58,8 @@ enum { dcraw_ahd_interpolation,
      };
 enum { unknown_thumb_type, jpeg_thumb_type, ppm_thumb_type };
 int dcraw_open(dcraw_data *h, char *filename);
+int dcraw_open_buffer(dcraw_data *h, char *filename,
+                      const void *buffer, size_t size);
 int dcraw_load_raw(dcraw_data *h);
 int dcraw_load_thumb(dcraw_data *h, dcraw_image_data *thumb);
 int dcraw_finalize_shrink(dcraw_image_data *f, dcraw_data *h,
@@ -69,6 +71,8 @@ int dcraw_set_color_scale(dcraw_data *h, int useCameraWB);
 void dcraw_wavelet_denoise(dcraw_data *h, float threshold);
 void dcraw_wavelet_denoise_shrinked(dcraw_image_data *f, float threshold);
 void dcraw_finalize_raw(dcraw_data *h, dcraw_data *dark, int rgbWB[4]);
+void dcraw_finalize_raw_rows(dcraw_data *h, dcraw_data *dark,
+                             const int rgbWB[4], int first, int last);
 int dcraw_finalize_interpolate(dcraw_image_data *f, dcraw_data *h,
                                int interpolation, int smoothing);
 void dcraw_close(dcraw_data *h);
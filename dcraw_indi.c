@@ -26,6 +26,7 @@
 #include <glib/gi18n.h> /*For _(String) definition - NKBJ*/
 #include "dcraw_api.h"
 #include "uf_progress.h"
+#include "ufraw_cielab.h"
 
 #ifdef _OPENMP
 #include <omp.h>
@@ -103,15 +104,281 @@ static void CLASS merror(void *ptr, char *where)
     g_error("Out of memory in %s\n", where);
 }
 
-static void CLASS hat_transform(float *temp, float *base, int st, int size, int sc)
+/*
+ * Vector kernels of the wavelet denoise. They do the same float operations
+ * in the same order as the scalar code, so the results are identical. AVX
+ * is used when the CPU supports it, otherwise SSE2. The AVX code is built
+ * for the CPU features detected at run time, as in develop_linear_avx().
+ */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+    !defined(_WIN32)
+#define WAVELET_AVX
+#include <immintrin.h>
+#endif
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifdef WAVELET_AVX
+__attribute__((target("avx")))
+static int CLASS hat_sum_avx(float *out, const float *mid, const float *up,
+                             const float *down, int count)
+{
+    const __m256 quarter = _mm256_set1_ps(0.25);
+    int i;
+    for (i = 0; i + 8 <= count; i += 8) {
+        __m256 m = _mm256_loadu_ps(mid + i);
+        __m256 sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(m, m),
+                                                 _mm256_loadu_ps(up + i)),
+                                   _mm256_loadu_ps(down + i));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(sum, quarter));
+    }
+    return i;
+}
+
+__attribute__((target("avx")))
+static int CLASS wavelet_threshold_avx(float *fimg, float *hpass,
+                                       const float *lpass, float thold,
+                                       int count)
+{
+    const __m256 high = _mm256_set1_ps(thold);
+    const __m256 low = _mm256_set1_ps(-thold);
+    int i;
+    for (i = 0; i + 8 <= count; i += 8) {
+        __m256 h = _mm256_sub_ps(_mm256_loadu_ps(hpass + i),
+                                 _mm256_loadu_ps(lpass + i));
+        h = _mm256_or_ps(
+                _mm256_and_ps(_mm256_cmp_ps(h, low, _CMP_LT_OQ),
+                              _mm256_add_ps(h, high)),
+                _mm256_and_ps(_mm256_cmp_ps(h, high, _CMP_GT_OQ),
+                              _mm256_sub_ps(h, high)));
+        _mm256_storeu_ps(hpass + i, h);
+        if (hpass != fimg)
+            _mm256_storeu_ps(fimg + i,
+                             _mm256_add_ps(_mm256_loadu_ps(fimg + i), h));
+    }
+    return i;
+}
+#endif /*WAVELET_AVX*/
+
+/* out = (2 * mid + up + down) * 0.25 for count floats */
+static void CLASS hat_sum(float *out, const float *mid, const float *up,
+                          const float *down, int count)
+{
+    int i = 0;
+#ifdef WAVELET_AVX
+    if (__builtin_cpu_supports("avx"))
+        i = hat_sum_avx(out, mid, up, down, count);
+#endif
+#ifdef __SSE2__
+    const __m128 quarter = _mm_set1_ps(0.25);
+    for (; i + 4 <= count; i += 4) {
+        __m128 m = _mm_loadu_ps(mid + i);
+        __m128 sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(m, m),
+                                           _mm_loadu_ps(up + i)),
+                                _mm_loadu_ps(down + i));
+        _mm_storeu_ps(out + i, _mm_mul_ps(sum, quarter));
+    }
+#endif
+    for (; i < count; i++)
+        out[i] = (2 * mid[i] + up[i] + down[i]) * 0.25;
+}
+
+/*
+ * Soft threshold the details hpass - lpass, which are kept in hpass, and
+ * add them to fimg unless hpass is fimg. The vector code selects between
+ * h + thold, h - thold and zero with masks instead of branches.
+ */
+static void CLASS wavelet_threshold(float *fimg, float *hpass,
+                                    const float *lpass, float thold, int count)
+{
+    int i = 0;
+#ifdef WAVELET_AVX
+    if (__builtin_cpu_supports("avx"))
+        i = wavelet_threshold_avx(fimg, hpass, lpass, thold, count);
+#endif
+#ifdef __SSE2__
+    const __m128 high = _mm_set1_ps(thold);
+    const __m128 low = _mm_set1_ps(-thold);
+    for (; i + 4 <= count; i += 4) {
+        __m128 h = _mm_sub_ps(_mm_loadu_ps(hpass + i), _mm_loadu_ps(lpass + i));
+        h = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(h, low), _mm_add_ps(h, high)),
+                      _mm_and_ps(_mm_cmpgt_ps(h, high), _mm_sub_ps(h, high)));
+        _mm_storeu_ps(hpass + i, h);
+        if (hpass != fimg)
+            _mm_storeu_ps(fimg + i, _mm_add_ps(_mm_loadu_ps(fimg + i), h));
+    }
+#endif
+    for (; i < count; i++) {
+        hpass[i] -= lpass[i];
+        if	(hpass[i] < -thold) hpass[i] += thold;
+        else if (hpass[i] >  thold) hpass[i] -= thold;
+        else	 hpass[i] = 0;
+        if (hpass != fimg) fimg[i] += hpass[i];
+    }
+}
+
+/* The hat transform of a row of base, scaled by 0.25 into out */
+static void CLASS hat_transform_row(float *out, const float *base, int size,
+                                    int sc)
 {
     int i;
     for (i = 0; i < sc; i++)
-        temp[i] = 2 * base[st * i] + base[st * (sc - i)] + base[st * (i + sc)];
-    for (; i + sc < size; i++)
-        temp[i] = 2 * base[st * i] + base[st * (i - sc)] + base[st * (i + sc)];
+        out[i] = (2 * base[i] + base[sc - i] + base[i + sc]) * 0.25;
+    if (size - sc > i) {
+        hat_sum(out + i, base + i, base + i - sc, base + i + sc, size - sc - i);
+        i = size - sc;
+    }
     for (; i < size; i++)
-        temp[i] = 2 * base[st * i] + base[st * (i - sc)] + base[st * (2 * size - 2 - (i + sc))];
+        out[i] = (2 * base[i] + base[i - sc] + base[2 * size - 2 - (i + sc)]) * 0.25;
+}
+
+/*
+ * hat_transform_row() of all the columns of base into out. It runs over
+ * whole rows, so that neighbouring columns are transformed together and
+ * the memory is read sequentially.
+ */
+static void CLASS hat_transform_columns(float *out, const float *base,
+                                        int width, int height, int sc)
+{
+    int row;
+    for (row = 0; row < height; row++) {
+        const float *up, *down, *mid = base + row * width;
+        if (row < sc) {
+            up = base + (sc - row) * width;
+            down = base + (row + sc) * width;
+        } else if (row + sc < height) {
+            up = base + (row - sc) * width;
+            down = base + (row + sc) * width;
+        } else {
+            up = base + (row - sc) * width;
+            down = base + (2 * height - 2 - (row + sc)) * width;
+        }
+        hat_sum(out + row * width, mid, up, down, width);
+    }
+}
+
+/*
+ * Pull count greens closer to the average of their diagonal neighbours
+ * of the other green. sum is the sum of the four neighbours minus four
+ * times black, mid is the green minus black and val is the green itself.
+ * The results are written to out.
+ */
+#ifdef WAVELET_AVX
+__attribute__((target("avx")))
+static int CLASS green_equilibrate_avx(ushort *out, const int *sum,
+                                       const int *mid, const ushort *val,
+                                       int count, float mul, int black,
+                                       float thold)
+{
+    const __m256d mulv = _mm256_set1_pd(mul);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d blackv = _mm256_set1_pd(black);
+    const __m128 high = _mm_set1_ps(thold);
+    const __m128 low = _mm_set1_ps(-thold);
+    const __m128i max = _mm_set1_epi32(0xFFFF);
+    int i;
+    for (i = 0; i + 4 <= count; i += 4) {
+        /* The product is rounded to float, as in the scalar code */
+        __m256d avgd = _mm256_cvtps_pd(_mm256_cvtpd_ps(_mm256_mul_pd(
+                _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(sum + i))),
+                mulv)));
+        avgd = _mm256_add_pd(_mm256_add_pd(avgd, _mm256_mul_pd(
+                                               _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(mid + i))),
+                                               half)), blackv);
+        __m128 avg = _mm_max_ps(_mm256_cvtpd_ps(avgd), _mm_setzero_ps());
+        avg = _mm256_cvtpd_ps(_mm256_sqrt_pd(_mm256_cvtps_pd(avg)));
+        __m256d v = _mm256_cvtepi32_pd(_mm_cvtepu16_epi32(
+                                           _mm_loadl_epi64((const __m128i *)(val + i))));
+        __m128 diff = _mm256_cvtpd_ps(_mm256_sub_pd(_mm256_sqrt_pd(v),
+                                                    _mm256_cvtps_pd(avg)));
+        diff = _mm_or_ps(_mm_and_ps(_mm_cmplt_ps(diff, low), _mm_add_ps(diff, high)),
+                         _mm_and_ps(_mm_cmpgt_ps(diff, high), _mm_sub_ps(diff, high)));
+        __m128 sq = _mm_add_ps(avg, diff);
+        sq = _mm_mul_ps(sq, sq);
+        __m128i r = _mm256_cvttpd_epi32(_mm256_add_pd(_mm256_cvtps_pd(sq), half));
+        r = _mm_min_epi32(_mm_max_epi32(r, _mm_setzero_si128()), max);
+        _mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi32(r, r));
+    }
+    return i;
+}
+#endif /*WAVELET_AVX*/
+
+static void CLASS green_equilibrate(ushort *out, const int *sum,
+                                    const int *mid, const ushort *val,
+                                    int count, float mul, int black,
+                                    float thold)
+{
+    float avg, diff;
+    int i = 0;
+#ifdef WAVELET_AVX
+    if (__builtin_cpu_supports("avx"))
+        i = green_equilibrate_avx(out, sum, mid, val, count, mul, black, thold);
+#endif
+    for (; i < count; i++) {
+        avg = sum[i] * mul + mid[i] * 0.5 + black;
+        avg = avg < 0 ? 0 : sqrt(avg);
+        diff = sqrt(val[i]) - avg;
+        if (diff < -thold) diff += thold;
+        else if (diff >  thold) diff -= thold;
+        else diff = 0;
+        out[i] = CLIP(SQR(avg + diff) + 0.5);
+    }
+}
+
+/* Rows of the bands of green_equilibrate() */
+#define GREEN_BAND 64
+
+/*
+ * The wavelet transform is done on tiles of about WAVELET_TILE pixels
+ * square, which together with their border fit in the L2 cache. Each of
+ * the five levels of the hat transform reaches 1 << lev pixels further, so
+ * a border of WAVELET_BORDER = 1+2+4+8+16 pixels makes the core of the
+ * tile exactly the same as a transform of the whole image.
+ */
+#define WAVELET_TILE 192
+#define WAVELET_BORDER 31
+
+/*
+ * Denoise color c of the tile (left, top, width, height), which is
+ * clipped to the image. fimg holds four planes of the tile size. The
+ * pixels of the core (coreLeft, coreTop, coreWidth, coreHeight) are
+ * written to out, whose rows are iwidth wide and start at row coreTop.
+ */
+static void CLASS wavelet_denoise_tile(float *fimg, ushort(*image)[4],
+                                       int iwidth, int c, int left, int top,
+                                       int width, int height, int coreLeft,
+                                       int coreTop, int coreWidth,
+                                       int coreHeight, ushort(*out)[4],
+                                       float threshold)
+{
+    static const float noise[] =
+    { 0.8002, 0.2735, 0.1202, 0.0585, 0.0291, 0.0152, 0.0080, 0.0044 };
+    const int size = width * height;
+    float *hpass, *lpass, *scratch = fimg + size, thold;
+    int lev, row, col, i;
+
+    for (row = 0; row < height; row++)
+        for (col = 0; col < width; col++)
+            fimg[row * width + col] =
+                256 * sqrt(image[(top + row) * iwidth + left + col][c] /*<< scale*/);
+    for (hpass = fimg, lev = 0; lev < 5; lev++) {
+        lpass = fimg + size * ((lev & 1) + 2);
+        for (row = 0; row < height; row++)
+            hat_transform_row(scratch + row * width, hpass + row * width,
+                              width, 1 << lev);
+        hat_transform_columns(lpass, scratch, width, height, 1 << lev);
+        thold = threshold * noise[lev];
+        wavelet_threshold(fimg, hpass, lpass, thold, size);
+        hpass = lpass;
+    }
+    for (row = coreTop - top; row < coreTop - top + coreHeight; row++)
+        for (col = coreLeft - left; col < coreLeft - left + coreWidth; col++) {
+            i = row * width + col;
+            out[(row + top - coreTop) * iwidth + left + col][c] =
+                CLIP(SQR(fimg[i] + lpass[i]) / 0x10000);
+        }
 }
 
 void CLASS wavelet_denoise_INDI(ushort(*image)[4], const int black,
@@ -121,87 +388,152 @@ void CLASS wavelet_denoise_INDI(ushort(*image)[4], const int black,
                                 const float pre_mul[4], const float threshold,
                                 const unsigned filters)
 {
-    float *fimg = 0, thold, mul[2], avg, diff;
-    int size, lev, hpass, lpass, row, col, nc, c, i, wlast;
+    float thold, mul[2];
+    int row, col, nc, c, i, wlast;
     ushort *window[4];
-    static const float noise[] =
-    { 0.8002, 0.2735, 0.1202, 0.0585, 0.0291, 0.0152, 0.0080, 0.0044 };
+    ufraw_progress_func progress_func = ufraw_progress_current();
 
 //  dcraw_message (dcraw, DCRAW_VERBOSE,_("Wavelet denoising...\n")); /*UF*/
 
     /* Scaling is done somewhere else - NKBJ*/
-    size = iheight * iwidth;
-    float temp[iheight + iwidth];
     if ((nc = colors) == 3 && filters) nc++;
-    progress(PROGRESS_WAVELET_DENOISE, -nc * 5);
+    /* The tiles are split evenly, so that no core is smaller than
+     * WAVELET_TILE, unless the image is. */
+    const int tilesX = MAX(iwidth / WAVELET_TILE, 1);
+    const int tilesY = MAX(iheight / WAVELET_TILE, 1);
+    const int tileWidth = MIN((iwidth + tilesX - 1) / tilesX + 2 * WAVELET_BORDER,
+                              iwidth);
+    const int tileHeight = MIN((iheight + tilesY - 1) / tilesY + 2 * WAVELET_BORDER,
+                               iheight);
+    /* The borders of a band of tiles overlap the core of the bands above
+     * and below it. The result of a band is kept in out until the band
+     * below has been read. */
+    ushort(*out[2])[4];
+    out[0] = (ushort(*)[4]) malloc(2 * ((iheight + tilesY - 1) / tilesY) *
+                                   iwidth * sizeof * out[0]);
+    merror(out[0], "wavelet_denoise()");
+    out[1] = out[0] + ((iheight + tilesY - 1) / tilesY) * iwidth;
+    progress_to(progress_func, PROGRESS_WAVELET_DENOISE, -nc * tilesX * tilesY);
 #ifdef _OPENMP
-#if defined(__sun) && !defined(__GNUC__)	/* Fix bug #3205673 - NKBJ */
-    #pragma omp parallel for				\
-    shared(nc,image,size,noise)				\
-    private(c,i,hpass,lev,lpass,row,col,thold,fimg,temp)
-#else
-    #pragma omp parallel for				\
-    shared(nc,image,size)				\
-    private(c,i,hpass,lev,lpass,row,col,thold,fimg,temp)
+    #pragma omp parallel default(shared) private(row, col, c, i)
+#endif
+    {
+        float *fimg = (float *) malloc(4 * tileWidth * tileHeight * sizeof * fimg);
+        merror(fimg, "wavelet_denoise()");
+        int band, tile;
+        for (band = 0; band <= tilesY; band++) {
+            int coreTop = band * iheight / tilesY;
+            int coreHeight = (band + 1) * iheight / tilesY - coreTop;
+            if (band < tilesY) {
+                int top = MAX(coreTop - WAVELET_BORDER, 0);
+                int bottom = MIN(coreTop + coreHeight + WAVELET_BORDER, iheight);
+#ifdef _OPENMP
+                #pragma omp for schedule(dynamic)
 #endif
+                for (tile = 0; tile < tilesX * nc; tile++) {
+                    long long traceStart = ufraw_trace_begin();
+                    int x = tile / nc;
+                    int coreLeft = x * iwidth / tilesX;
+                    int coreWidth = (x + 1) * iwidth / tilesX - coreLeft;
+                    int left = MAX(coreLeft - WAVELET_BORDER, 0);
+                    int right = MIN(coreLeft + coreWidth + WAVELET_BORDER, iwidth);
+                    /* denoise R,G1,B,G3 individually */
+                    wavelet_denoise_tile(fimg, image, iwidth, tile % nc, left, top,
+                                         right - left, bottom - top, coreLeft,
+                                         coreTop, coreWidth, coreHeight,
+                                         out[band & 1], threshold);
+                    progress_to(progress_func, PROGRESS_WAVELET_DENOISE, 1);
+                    ufraw_trace_end(traceStart, PROGRESS_WAVELET_DENOISE,
+                                    "wavelet tile", coreTop);
+                }
+            }
+            if (band == 0)
+                continue;
+            /* Write back the band above, now that its rows have been read */
+            coreTop = (band - 1) * iheight / tilesY;
+            coreHeight = band * iheight / tilesY - coreTop;
+#ifdef _OPENMP
+            #pragma omp for
 #endif
-    FORC(nc) {			/* denoise R,G1,B,G3 individually */
-        fimg = (float *) malloc(size * 3 * sizeof * fimg);
-        for (i = 0; i < size; i++)
-            fimg[i] = 256 * sqrt(image[i][c] /*<< scale*/);
-        for (hpass = lev = 0; lev < 5; lev++) {
-            progress(PROGRESS_WAVELET_DENOISE, 1);
-            lpass = size * ((lev & 1) + 1);
-            for (row = 0; row < iheight; row++) {
-                hat_transform(temp, fimg + hpass + row * iwidth, 1, iwidth, 1 << lev);
+            for (row = 0; row < coreHeight; row++) {
+                ushort(*src)[4] = out[(band - 1) & 1] + row * iwidth;
+                ushort(*dst)[4] = image + (coreTop + row) * iwidth;
                 for (col = 0; col < iwidth; col++)
-                    fimg[lpass + row * iwidth + col] = temp[col] * 0.25;
-            }
-            for (col = 0; col < iwidth; col++) {
-                hat_transform(temp, fimg + lpass + col, iwidth, iheight, 1 << lev);
-                for (row = 0; row < iheight; row++)
-                    fimg[lpass + row * iwidth + col] = temp[row] * 0.25;
-            }
-            thold = threshold * noise[lev];
-            for (i = 0; i < size; i++) {
-                fimg[hpass + i] -= fimg[lpass + i];
-                if	(fimg[hpass + i] < -thold) fimg[hpass + i] += thold;
-                else if (fimg[hpass + i] >  thold) fimg[hpass + i] -= thold;
-                else	 fimg[hpass + i] = 0;
-                if (hpass) fimg[i] += fimg[hpass + i];
+                    FORC(nc) dst[col][c] = src[col][c];
             }
-            hpass = lpass;
         }
-        for (i = 0; i < size; i++)
-            image[i][c] = CLIP(SQR(fimg[i] + fimg[lpass + i]) / 0x10000);
         free(fimg);
-    }
+    } /* _OPENMP */
+    free(out[0]);
     if (filters && colors == 3) {  /* pull G1 and G3 closer together */
         for (row = 0; row < 2; row++)
             mul[row] = 0.125 * pre_mul[FC(row + 1, 0) | 1] / pre_mul[FC(row, 0) | 1];
-        ushort window_mem[4][width];
-        for (i = 0; i < 4; i++)
-            window[i] = window_mem[i]; /*(ushort *) fimg + width*i;*/
-        for (wlast = -1, row = 1; row < height - 1; row++) {
-            while (wlast < row + 1) {
-                for (wlast++, i = 0; i < 4; i++)
-                    window[(i + 3) & 3] = window[i];
-                for (col = FC(wlast, 1) & 1; col < width; col += 2)
-                    window[2][col] = BAYER(wlast, col);
+        thold = threshold / 512;
+        /* The rows are done in bands, each with its own window. With the
+         * two greens in different channels (fourColorFilters) only original
+         * greens are read, so the rows just outside each band are saved
+         * before the neighbouring bands change them. */
+        const int bands = MAX((height - 2) / GREEN_BAND, 1);
+        ushort(*edge)[2][width] = (ushort(*)[2][width])
+                                  malloc(bands * sizeof * edge);
+        merror(edge, "wavelet_denoise()");
+#ifdef _OPENMP
+        #pragma omp parallel default(shared) private(row, col, i, wlast, window)
+#endif
+        {
+            int band;
+            ushort *window_mem = g_new(ushort, 4 * width);
+            ushort *val = g_new(ushort, width / 2 + 1);
+            ushort *res = g_new(ushort, width / 2 + 1);
+            int *sum = g_new(int, width / 2 + 1);
+            int *mid = g_new(int, width / 2 + 1);
+#ifdef _OPENMP
+            #pragma omp for
+#endif
+            for (band = 0; band < bands; band++) {
+                int first = 1 + band * (height - 2) / bands;
+                int last = 1 + (band + 1) * (height - 2) / bands;
+                for (col = FC(first - 1, 1) & 1; col < width; col += 2)
+                    edge[band][0][col] = BAYER(first - 1, col);
+                for (col = FC(last, 1) & 1; col < width; col += 2)
+                    edge[band][1][col] = BAYER(last, col);
             }
-            thold = threshold / 512;
-            for (col = (FC(row, 0) & 1) + 1; col < width - 1; col += 2) {
-                avg = (window[0][col - 1] + window[0][col + 1] +
-                       window[2][col - 1] + window[2][col + 1] - black * 4)
-                      * mul[row & 1] + (window[1][col] - black) * 0.5 + black;
-                avg = avg < 0 ? 0 : sqrt(avg);
-                diff = sqrt(BAYER(row, col)) - avg;
-                if (diff < -thold) diff += thold;
-                else if (diff >  thold) diff -= thold;
-                else diff = 0;
-                BAYER(row, col) = CLIP(SQR(avg + diff) + 0.5);
+#ifdef _OPENMP
+            #pragma omp for schedule(dynamic)
+#endif
+            for (band = 0; band < bands; band++) {
+                int first = 1 + band * (height - 2) / bands;
+                int last = 1 + (band + 1) * (height - 2) / bands;
+                for (i = 0; i < 4; i++)
+                    window[i] = window_mem + width * i;
+                for (wlast = first - 2, row = first; row < last; row++) {
+                    while (wlast < row + 1) {
+                        for (wlast++, i = 0; i < 4; i++)
+                            window[(i + 3) & 3] = window[i];
+                        const ushort *saved = wlast == first - 1 ? edge[band][0] :
+                                              wlast == last ? edge[band][1] : NULL;
+                        for (col = FC(wlast, 1) & 1; col < width; col += 2)
+                            window[2][col] = saved ? saved[col] : BAYER(wlast, col);
+                    }
+                    for (i = 0, col = (FC(row, 0) & 1) + 1; col < width - 1; col += 2, i++) {
+                        sum[i] = window[0][col - 1] + window[0][col + 1] +
+                                 window[2][col - 1] + window[2][col + 1] - black * 4;
+                        mid[i] = window[1][col] - black;
+                        val[i] = BAYER(row, col);
+                    }
+                    green_equilibrate(res, sum, mid, val, i, mul[row & 1], black,
+                                      thold);
+                    for (i = 0, col = (FC(row, 0) & 1) + 1; col < width - 1; col += 2, i++)
+                        BAYER(row, col) = res[i];
+                }
             }
-        }
+            g_free(window_mem);
+            g_free(val);
+            g_free(res);
+            g_free(sum);
+            g_free(mid);
+        } /* _OPENMP */
+        free(edge);
     }
 }
 
@@ -338,7 +670,7 @@ void CLASS lin_interpolate_INDI(ushort(*image)[4], const unsigned filters,
 void CLASS vng_interpolate_INDI(ushort(*image)[4], const unsigned filters,
                                 const int width, const int height, const int colors, void *dcraw, dcraw_data *h) /*UF*/
 {
-    static const signed char *cp, terms[] = {
+    static const signed char terms[] = {
         -2, -2, +0, -1, 0, 0x01, -2, -2, +0, +0, 1, 0x01, -2, -1, -1, +0, 0, 0x01,
         -2, -1, +0, -1, 0, 0x02, -2, -1, +0, +0, 0, 0x03, -2, -1, +0, +1, 1, 0x01,
         -2, +0, +0, -1, 0, 0x06, -2, +0, +0, +0, 1, 0x02, -2, +0, +0, +1, 0, 0x03,
@@ -362,11 +694,13 @@ void CLASS vng_interpolate_INDI(ushort(*image)[4], const unsigned filters,
         +1, -1, +1, +1, 0, 0x88, +1, +0, +1, +2, 0, 0x08, +1, +0, +2, -1, 0, 0x40,
         +1, +0, +2, +1, 0, 0x10
     }, chood[] = { -1, -1, -1, 0, -1, +1, 0, +1, +1, +1, +1, 0, +1, -1, 0, -1 };
+    const signed char *cp;
     ushort(*brow[4])[4], *pix;
     int prow = 8, pcol = 2, *ip, *code[16][16], gval[8], gmin, gmax, sum[4];
     int row, col, x, y, x1, x2, y1, y2, t, weight, grads, color, diag;
     int g, diff, thold, num, c;
     ushort rowtmp[4][width * 4];
+    ufraw_progress_func progress_func = ufraw_progress_current();
 
     lin_interpolate_INDI(image, filters, width, height, colors, dcraw, h); /*UF*/
     dcraw_message(dcraw, DCRAW_VERBOSE, _("VNG interpolation...\n")); /*UF*/
@@ -408,7 +742,7 @@ void CLASS vng_interpolate_INDI(ushort(*image)[4], const unsigned filters,
                     *ip++ = 0;
             }
         }
-    progress(PROGRESS_INTERPOLATE, -height);
+    progress_to(progress_func, PROGRESS_INTERPOLATE, -height);
 #ifdef _OPENMP
     #pragma omp parallel				\
     shared(image,code,prow,pcol,h)			\
@@ -419,7 +753,7 @@ void CLASS vng_interpolate_INDI(ushort(*image)[4], const unsigned filters,
         int start_row = 2 + slice * uf_omp_get_thread_num();
         int end_row = MIN(start_row + slice, height - 2);
         for (row = start_row; row < end_row; row++) { /* Do VNG interpolation */
-            progress(PROGRESS_INTERPOLATE, 1);
+            progress_to(progress_func, PROGRESS_INTERPOLATE, 1);
             for (g = 0; g < 4; g++)
                 brow[g] = &rowtmp[(row + g - 2) % 4];
             for (col = 2; col < width - 2; col++) {
@@ -552,36 +886,18 @@ void CLASS ppg_interpolate_INDI(ushort(*image)[4], const unsigned filters,
     }
 }
 
-void CLASS cielab_INDI(ushort rgb[3], short lab[3], const int colors,
-                       const float rgb_cam[3][4])
+/* The cube root table is shared with the developer, see ufraw_cielab.c.
+ * The camera to XYZ matrix belongs to the caller, so that several images
+ * can be interpolated at the same time. */
+void CLASS cielab_init_INDI(float xyz_cam[3][4], const int colors,
+                            const float rgb_cam[3][4])
 {
-    int c, i, j, k;
-    float r, xyz[3];
-    static float cbrt[0x10000], xyz_cam[3][4];
-
-    if (!rgb) {
-        for (i = 0; i < 0x10000; i++) {
-            r = i / 65535.0;
-            cbrt[i] = r > 0.008856 ? pow(r, (float)(1 / 3.0)) : 7.787 * r + 16 / 116.0;
-        }
-        for (i = 0; i < 3; i++)
-            for (j = 0; j < colors; j++)
-                for (xyz_cam[i][j] = k = 0; k < 3; k++)
-                    xyz_cam[i][j] += xyz_rgb[i][k] * rgb_cam[k][j] / d65_white[i];
-        return;
-    }
-    xyz[0] = xyz[1] = xyz[2] = 0.5;
-    FORCC {
-        xyz[0] += xyz_cam[0][c] * rgb[c];
-        xyz[1] += xyz_cam[1][c] * rgb[c];
-        xyz[2] += xyz_cam[2][c] * rgb[c];
-    }
-    xyz[0] = cbrt[CLIP((int) xyz[0])];
-    xyz[1] = cbrt[CLIP((int) xyz[1])];
-    xyz[2] = cbrt[CLIP((int) xyz[2])];
-    lab[0] = 64 * (116 * xyz[1] - 16);
-    lab[1] = 64 * 500 * (xyz[0] - xyz[1]);
-    lab[2] = 64 * 200 * (xyz[1] - xyz[2]);
+    int i, j, k;
+
+    for (i = 0; i < 3; i++)
+        for (j = 0; j < colors; j++)
+            for (xyz_cam[i][j] = k = 0; k < 3; k++)
+                xyz_cam[i][j] += xyz_rgb[i][k] * rgb_cam[k][j] / d65_white[i];
 }
 
 #define TS 512		/* Tile Size */
@@ -604,12 +920,13 @@ void CLASS xtrans_interpolate_INDI(ushort(*image)[4], const unsigned filters,
     ushort min, max, sgrow = 0, sgcol = 0;
     ushort(*rgb)[TS][TS][3], (*rix)[3], (*pix)[4];
     short(*lab)    [TS][3], (*lix)[3];
-    float(*drv)[TS][TS], diff[6], tr;
+    float(*drv)[TS][TS], diff[6], tr, xyz_cam[3][4];
     char(*homo)[TS][TS], *buffer;
+    ufraw_progress_func progress_func = ufraw_progress_current();
 
     dcraw_message(dcraw, DCRAW_VERBOSE, _("%d-pass X-Trans interpolation...\n"), passes); /*NKBJ*/
 
-    cielab_INDI(0, 0, colors, rgb_cam);
+    cielab_init_INDI(xyz_cam, colors, rgb_cam);
     ndir = 4 << (passes > 1);
 
     /* Map a green hexagon around each non-green pixel and vice versa:      */
@@ -670,15 +987,16 @@ void CLASS xtrans_interpolate_INDI(ushort(*image)[4], const unsigned filters,
         drv  = (float(*)[TS][TS])(buffer + TS * TS * (ndir * 6 + 6));
         homo = (char(*)[TS][TS])(buffer + TS * TS * (ndir * 10 + 6));
 
-        progress(PROGRESS_INTERPOLATE, -height);
+        progress_to(progress_func, PROGRESS_INTERPOLATE, -height);
 
 #ifdef _OPENMP
         #pragma omp for
 #endif
 
         for (top = 3; top < height - 19; top += TS - 16) {
-            progress(PROGRESS_INTERPOLATE, TS - 16);
+            progress_to(progress_func, PROGRESS_INTERPOLATE, TS - 16);
             for (left = 3; left < width - 19; left += TS - 16) {
+                long long traceStart = ufraw_trace_begin();
                 mrow = MIN(top + TS, height - 3);
                 mcol = MIN(left + TS, width - 3);
                 for (row = top; row < mrow; row++)
@@ -787,8 +1105,8 @@ void CLASS xtrans_interpolate_INDI(ushort(*image)[4], const unsigned filters,
                 /* Convert to CIELab and differentiate in all directions:       */
                 for (d = 0; d < ndir; d++) {
                     for (row = 2; row < mrow - 2; row++)
-                        for (col = 2; col < mcol - 2; col++)
-                            cielab_INDI(rgb[d][row][col], lab[row][col], colors, rgb_cam);
+                        uf_cielab_row((const ushort(*)[3])&rgb[d][row][2], &lab[row][2],
+                                      mcol - 4, colors, (const float (*)[4])xyz_cam);
                     for (f = dir[d & 3], row = 3; row < mrow - 3; row++)
                         for (col = 3; col < mcol - 3; col++) {
                             lix = &lab[row][col];
@@ -837,6 +1155,8 @@ void CLASS xtrans_interpolate_INDI(ushort(*image)[4], const unsigned filters,
                             }
                         FORC3 image[(row + top)*width + col + left][c] = avg[c] / avg[3];
                     }
+                ufraw_trace_end(traceStart, PROGRESS_INTERPOLATE,
+                                "xtrans tile", top);
             }
         }
         free(buffer);
@@ -859,8 +1179,11 @@ void CLASS ahd_interpolate_INDI(ushort(*image)[4], const unsigned filters,
     ushort(*rgb)[TS][TS][3], (*rix)[3], (*pix)[4];
     short(*lab)[TS][TS][3], (*lix)[3];
     char(*homo)[TS][TS], *buffer;
+    float xyz_cam[3][4];
+    ufraw_progress_func progress_func = ufraw_progress_current();
 
     dcraw_message(dcraw, DCRAW_VERBOSE, _("AHD interpolation...\n")); /*UF*/
+    cielab_init_INDI(xyz_cam, colors, rgb_cam);
 
 #ifdef _OPENMP
     #pragma omp parallel				\
@@ -868,7 +1191,6 @@ void CLASS ahd_interpolate_INDI(ushort(*image)[4], const unsigned filters,
     private(top, left, row, col, pix, rix, lix, c, val, d, tc, tr, i, j, ldiff, abdiff, leps, abeps, hm, buffer, rgb, lab, homo)
 #endif
     {
-        cielab_INDI(0, 0, colors, rgb_cam);
         border_interpolate_INDI(height, width, image, filters, colors, 5, h);
         buffer = (char *) malloc(26 * TS * TS);
         merror(buffer, "ahd_interpolate()");
@@ -876,13 +1198,14 @@ void CLASS ahd_interpolate_INDI(ushort(*image)[4], const unsigned filters,
         lab  = (short(*)[TS][TS][3])(buffer + 12 * TS * TS);
         homo = (char(*)[TS][TS])(buffer + 24 * TS * TS);
 
-        progress(PROGRESS_INTERPOLATE, -height);
+        progress_to(progress_func, PROGRESS_INTERPOLATE, -height);
 #ifdef _OPENMP
         #pragma omp for
 #endif
         for (top = 2; top < height - 5; top += TS - 6) {
-            progress(PROGRESS_INTERPOLATE, TS - 6);
+            progress_to(progress_func, PROGRESS_INTERPOLATE, TS - 6);
             for (left = 2; left < width - 5; left += TS - 6) {
+                long long traceStart = ufraw_trace_begin();
 
                 /*  Interpolate green horizontally and vertically: */
                 for (row = top; row < top + TS && row < height - 2; row++) {
@@ -899,11 +1222,10 @@ void CLASS ahd_interpolate_INDI(ushort(*image)[4], const unsigned filters,
                 }
                 /*  Interpolate red and blue, and convert to CIELab: */
                 for (d = 0; d < 2; d++)
-                    for (row = top + 1; row < top + TS - 1 && row < height - 3; row++)
+                    for (row = top + 1; row < top + TS - 1 && row < height - 3; row++) {
                         for (col = left + 1; col < left + TS - 1 && col < width - 3; col++) {
                             pix = image + row * width + col;
                             rix = &rgb[d][row - top][col - left];
-                            lix = &lab[d][row - top][col - left];
                             if ((c = 2 - FC(row, col)) == 1) {
                                 c = FC(row + 1, col);
                                 val = pix[0][1] + ((pix[-1][2 - c] + pix[1][2 - c]
@@ -919,8 +1241,11 @@ void CLASS ahd_interpolate_INDI(ushort(*image)[4], const unsigned filters,
                             rix[0][c] = CLIP(val);
                             c = FC(row, col);
                             rix[0][c] = pix[0][c];
-                            cielab_INDI(rix[0], lix[0], colors, rgb_cam);
                         }
+                        uf_cielab_row((const ushort(*)[3])&rgb[d][row - top][1],
+                                      &lab[d][row - top][1], col - left - 1,
+                                      colors, (const float (*)[4])xyz_cam);
+                    }
                 /*  Build homogeneity maps from the CIELab images: */
                 memset(homo, 0, 2 * TS * TS);
                 for (row = top + 2; row < top + TS - 2 && row < height - 4; row++) {
@@ -961,6 +1286,8 @@ void CLASS ahd_interpolate_INDI(ushort(*image)[4], const unsigned filters,
                                 (rgb[0][tr][tc][c] + rgb[1][tr][tc][c]) >> 1;
                     }
                 }
+                ufraw_trace_end(traceStart, PROGRESS_INTERPOLATE, "ahd tile",
+                                top);
             }
         }
         free(buffer);
@@ -21,7 +21,32 @@
 #define PROGRESS_LOAD			5
 #define PROGRESS_SAVE			6
 
-extern void (*ufraw_progress)(int what, int ticks);
+#include <stddef.h>
+
+/* Stages measured by ufraw_timing_begin() and ufraw_timing_end(). */
+#define TIMING_OPEN			0
+#define TIMING_LOAD_RAW			1
+#define TIMING_SCALE_RAW		2
+#define TIMING_HOTPIXELS		3
+#define TIMING_DENOISE			4
+#define TIMING_FINALIZE_RAW		5
+#define TIMING_DESPECKLE		6
+#define TIMING_TCA			7
+#define TIMING_INTERPOLATE		8
+#define TIMING_SMOOTH			9
+#define TIMING_RESIZE			10	/* shrink, stretch, flip */
+#define TIMING_TRANSFORM		11	/* vignetting, distortion */
+#define TIMING_PREPARE			12	/* developer LUTs and ICC transforms */
+#define TIMING_DEVELOP			13
+#define TIMING_ENCODE			14
+#define TIMING_STAGES			15
+
+typedef void (*ufraw_progress_func)(int what, int ticks);
+
+/* Default progress callback, used by threads whose ufraw_context does not
+ * set one. ufraw_progress_current() returns the callback for this thread. */
+extern ufraw_progress_func ufraw_progress;
+ufraw_progress_func ufraw_progress_current(void);
 
 /*
  * The first call for a PROGRESS_* activity should specify a negative number
@@ -31,11 +56,39 @@ extern void (*ufraw_progress)(int what, int ticks);
  * of ticks including the initialization call should be approximately zero.
  *
  * This function is thread safe. See also preview_progress().
+ * Code running in worker threads (OpenMP) should fetch the callback with
+ * ufraw_progress_current() before forking and report with progress_to(),
+ * since the workers do not share the context of the calling thread.
  */
+static inline void progress_to(ufraw_progress_func func, int what, int ticks)
+{
+    if (func)
+        func(what, ticks);
+}
+
 static inline void progress(int what, int ticks)
 {
-    if (ufraw_progress)
-        ufraw_progress(what, ticks);
+    progress_to(ufraw_progress_current(), what, ticks);
 }
 
+/*
+ * Bracket a TIMING_* stage. bytes is the size of the image buffer the
+ * stage worked on, the largest one is reported as the peak memory of the
+ * stage. Both are no-ops unless the ufraw_context of the calling thread
+ * collects timings, and should only be called from that thread.
+ */
+void ufraw_timing_begin(int stage);
+void ufraw_timing_end(int stage, size_t bytes);
+
+/*
+ * Record a block of work of a PROGRESS_* activity in the trace of the
+ * calling thread, which may be an OpenMP worker. ufraw_trace_begin()
+ * returns -1 if no trace is recorded. index identifies the block (a tile
+ * row or a color plane), a negative index is omitted from the trace.
+ * Stages bracketed by ufraw_timing_begin() and ufraw_timing_end() are
+ * traced too.
+ */
+long long ufraw_trace_begin(void);
+void ufraw_trace_end(long long start, int what, const char *name, int index);
+
 #endif /* _UF_PROGRESS_H */
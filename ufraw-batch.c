@@ -15,12 +15,50 @@
 #include <errno.h>     /* for errno */
 #include <string.h>
 #include <glib/gi18n.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 static gboolean silentMessenger;
+static int timingsFormat;
 char *ufraw_binary;
 
 int ufraw_batch_saver(ufraw_data *uf);
 
+/* With --jobs=N, files are opened and configured in the main thread and
+ * then pass through a pipeline of three stages, each with its own thread
+ * pool: loading the raw data, developing the image and encoding the output
+ * file. While one file is developed, the next ones can be loaded and the
+ * previous ones encoded. At most N files are in the pipeline at the same
+ * time, which bounds both the queues between the stages and the memory.
+ * The messages of each file are held in its ufraw_context and shown after
+ * those of all previous files, so the output looks the same as without
+ * --jobs. */
+typedef struct {
+    ufraw_data *uf;
+    ufraw_context *context;
+    char filename[max_path];
+    char stat[max_name];
+    int exitCode;
+    gboolean done;
+} batch_job;
+
+typedef struct {
+    GThreadPool *load, *develop, *encode;
+    GAsyncQueue *finished;
+    int stageThreads; /* OpenMP threads for the load and encode stages */
+} batch_pipeline;
+
+static int ufraw_batch_convert(ufraw_data *uf, const char *stat);
+static int ufraw_batch_prepare_output(ufraw_data *uf);
+static int ufraw_batch_write(ufraw_data *uf, gboolean converted);
+static void ufraw_batch_pipeline_new(batch_pipeline *pipeline, int jobs);
+static void ufraw_batch_pipeline_free(batch_pipeline *pipeline);
+static int ufraw_batch_job_show(batch_job *job, int count, int *shown);
+static void ufraw_batch_timings_show(ufraw_context *context,
+                                     const char *filename);
+static gboolean ufraw_batch_trace_close(void);
+
 int main(int argc, char **argv)
 {
     ufraw_data *uf;
@@ -55,6 +93,11 @@ int main(int argc, char **argv)
     if (optInd < 0) exit(1);
     if (optInd == 0) exit(0);
     silentMessenger = cmd.silent;
+    timingsFormat = cmd.timings == -1 ? no_timings : cmd.timings;
+    if (strlen(cmd.traceFilename) > 0) {
+        ufraw_trace_open(cmd.traceFilename);
+        ufraw_trace_thread_name("main");
+    }
 
     conf_file_load(&conf, cmd.inputFilename);
 
@@ -63,13 +106,58 @@ int main(int argc, char **argv)
     }
     int fileCount = argc - optInd;
     int fileIndex = 1;
+    int jobs = MIN(MAX(cmd.jobs, 1), fileCount);
+    batch_pipeline stages, *pipeline = NULL;
+    batch_job *job = NULL, *current = NULL;
+    ufraw_context *context = NULL;
+    int running = 0, shown = 0;
+    if (jobs > 1) {
+        /* Before Exiv2 is used by the threads of the pipeline */
+        ufraw_exif_init();
+        pipeline = &stages;
+        ufraw_batch_pipeline_new(pipeline, jobs);
+        job = g_new0(batch_job, fileCount);
+    }
     for (; optInd < argc; optInd++, fileIndex++) {
+        char stat[max_name];
+        if (fileCount > 1)
+            g_snprintf(stat, max_name, "[%d/%d]", fileIndex, fileCount);
+        else
+            stat[0] = '\0';
+        if (pipeline != NULL) {
+            /* Only 'jobs' images are kept in memory at the same time */
+            for (; running >= jobs; running--) {
+                current = g_async_queue_pop(pipeline->finished);
+                current->done = TRUE;
+                exitCode |= ufraw_batch_job_show(job, fileCount, &shown);
+            }
+            current = &job[fileIndex - 1];
+            current->context = ufraw_context_new();
+            current->context->heldMessages = g_ptr_array_new();
+            context = current->context;
+        } else if (timingsFormat != no_timings) {
+            context = ufraw_context_new();
+        }
+        if (context != NULL) {
+            if (timingsFormat != no_timings)
+                context->timings = ufraw_timings_new();
+            ufraw_context_set(context);
+        }
         argFile = uf_win32_locale_to_utf8(argv[optInd]);
         uf = ufraw_open(argFile);
         uf_win32_locale_free(argFile);
         if (uf == NULL) {
             exitCode = 1;
             ufraw_message(UFRAW_REPORT, NULL);
+            if (pipeline == NULL && context != NULL) {
+                ufraw_context_set(NULL);
+                ufraw_context_free(context);
+                context = NULL;
+            } else if (pipeline != NULL) {
+                ufraw_context_set(NULL);
+                current->done = TRUE;
+                exitCode |= ufraw_batch_job_show(job, fileCount, &shown);
+            }
             continue;
         }
         status = ufraw_config(uf, &rc, &conf, &cmd);
@@ -80,20 +168,64 @@ int main(int argc, char **argv)
             ufraw_close_darkframe(uf->conf);
             ufraw_close(uf);
             g_free(uf);
+            if (pipeline != NULL) {
+                /* Finish the files before this one and show all messages */
+                ufraw_context_set(NULL);
+                current->done = TRUE;
+                for (; running > 0; running--)
+                    ((batch_job *)g_async_queue_pop(pipeline->finished))->done =
+                        TRUE;
+                ufraw_batch_job_show(job, fileCount, &shown);
+            }
+            ufraw_batch_trace_close();
             exit(1);
         }
-        if (ufraw_load_raw(uf) != UFRAW_SUCCESS) {
-            exitCode = 1;
-            ufraw_close_darkframe(uf->conf);
-            ufraw_close(uf);
-            g_free(uf);
-            continue;
+        if (pipeline != NULL) {
+            ufraw_context_set(NULL);
+            current->uf = uf;
+            g_strlcpy(current->filename, uf->filename, max_path);
+            g_strlcpy(current->stat, stat, max_name);
+            g_thread_pool_push(pipeline->load, current, NULL);
+            running++;
+        } else {
+            char filename[max_path];
+            g_strlcpy(filename, uf->filename, max_path);
+            if (ufraw_batch_convert(uf, stat) != 0)
+                exitCode = 1;
+            if (context != NULL) {
+                ufraw_context_set(NULL);
+                ufraw_batch_timings_show(context, filename);
+                ufraw_context_free(context);
+            }
         }
-        char stat[max_name];
-        if (fileCount > 1)
-            g_snprintf(stat, max_name, "[%d/%d]", fileIndex, fileCount);
-        else
-            stat[0] = '\0';
+        context = NULL;
+    }
+    if (pipeline != NULL) {
+        for (; running > 0; running--) {
+            current = g_async_queue_pop(pipeline->finished);
+            current->done = TRUE;
+            exitCode |= ufraw_batch_job_show(job, fileCount, &shown);
+        }
+        ufraw_batch_pipeline_free(pipeline);
+        g_free(job);
+    }
+    if (!ufraw_batch_trace_close())
+        exitCode = 1;
+//    ufraw_close(cmd.darkframe);
+    ufobject_delete(cmd.ufobject);
+    ufobject_delete(rc.ufobject);
+    exit(exitCode);
+}
+
+/* Load and save a configured file. Returns the exit code for the file. */
+static int ufraw_batch_convert(ufraw_data *uf, const char *stat)
+{
+    int status;
+    int exitCode = 0;
+
+    if (ufraw_load_raw(uf) != UFRAW_SUCCESS) {
+        exitCode = 1;
+    } else {
         ufraw_message(UFRAW_MESSAGE, _("Loaded %s %s"), uf->filename, stat);
         status = ufraw_batch_saver(uf);
         if (status == UFRAW_SUCCESS || status == UFRAW_WARNING) {
@@ -103,22 +235,189 @@ int main(int argc, char **argv)
         } else {
             exitCode = 1;
         }
-        ufraw_close_darkframe(uf->conf);
-        ufraw_close(uf);
-        g_free(uf);
     }
-//    ufraw_close(cmd.darkframe);
-    ufobject_delete(cmd.ufobject);
-    ufobject_delete(rc.ufobject);
-    exit(exitCode);
+    ufraw_close_darkframe(uf->conf);
+    ufraw_close(uf);
+    g_free(uf);
+    return exitCode;
+}
+
+/* Finish a job in the pipeline, possibly before its last stage */
+static void ufraw_batch_job_finish(batch_job *job,
+                                   batch_pipeline *pipeline, int exitCode)
+{
+    job->exitCode = exitCode;
+    if (job->uf != NULL) {
+        ufraw_close_darkframe(job->uf->conf);
+        ufraw_close(job->uf);
+        g_free(job->uf);
+        job->uf = NULL;
+    }
+    ufraw_context_set(NULL);
+    g_async_queue_push(pipeline->finished, job);
 }
 
+static void ufraw_batch_load_stage(gpointer data, gpointer user_data)
+{
+    batch_job *job = data;
+    batch_pipeline *pipeline = user_data;
+
+#ifdef _OPENMP
+    omp_set_num_threads(pipeline->stageThreads);
+#endif
+    ufraw_trace_thread_name("load");
+    ufraw_context_set(job->context);
+    if (ufraw_load_raw(job->uf) != UFRAW_SUCCESS) {
+        ufraw_batch_job_finish(job, pipeline, 1);
+        return;
+    }
+    ufraw_message(UFRAW_MESSAGE, _("Loaded %s %s"), job->uf->filename,
+                  job->stat);
+    ufraw_context_set(NULL);
+    g_thread_pool_push(pipeline->develop, job, NULL);
+}
+
+/* A single thread develops the images, using all the processors */
+static void ufraw_batch_develop_stage(gpointer data, gpointer user_data)
+{
+    batch_job *job = data;
+    batch_pipeline *pipeline = user_data;
+    ufraw_data *uf = job->uf;
+    int status;
+
+#ifdef _OPENMP
+    omp_set_num_threads(omp_get_num_procs());
+#endif
+    ufraw_trace_thread_name("develop");
+    ufraw_context_set(job->context);
+    /* Ask about overwriting before spending time on the image */
+    if (ufraw_batch_prepare_output(uf) != UFRAW_SUCCESS) {
+        ufraw_batch_job_finish(job, pipeline, 1);
+        return;
+    }
+    if (uf->conf->embeddedImage)
+        status = ufraw_convert_embedded(uf);
+    else if (uf->conf->createID != only_id)
+        status = ufraw_convert_image(uf);
+    else
+        status = UFRAW_SUCCESS;
+    if (status != UFRAW_SUCCESS) {
+        ufraw_batch_job_finish(job, pipeline, 1);
+        return;
+    }
+    ufraw_context_set(NULL);
+    g_thread_pool_push(pipeline->encode, job, NULL);
+}
+
+static void ufraw_batch_encode_stage(gpointer data, gpointer user_data)
+{
+    batch_job *job = data;
+    batch_pipeline *pipeline = user_data;
+    ufraw_data *uf = job->uf;
+    int status;
+
+#ifdef _OPENMP
+    omp_set_num_threads(pipeline->stageThreads);
+#endif
+    ufraw_trace_thread_name("encode");
+    ufraw_context_set(job->context);
+    status = ufraw_batch_write(uf, TRUE);
+    if (status == UFRAW_SUCCESS || status == UFRAW_WARNING) {
+        if (uf->conf->createID != only_id)
+            ufraw_message(UFRAW_MESSAGE, _("Saved %s %s"),
+                          uf->conf->outputFilename, job->stat);
+        ufraw_batch_job_finish(job, pipeline, 0);
+    } else {
+        ufraw_batch_job_finish(job, pipeline, 1);
+    }
+}
+
+static void ufraw_batch_pipeline_new(batch_pipeline *pipeline, int jobs)
+{
+    pipeline->finished = g_async_queue_new();
+    pipeline->stageThreads = 1;
+#ifdef _OPENMP
+    pipeline->stageThreads = MAX(omp_get_num_procs() / jobs, 1);
+#endif
+    pipeline->load = g_thread_pool_new(ufraw_batch_load_stage, pipeline,
+                                       jobs, TRUE, NULL);
+    pipeline->develop = g_thread_pool_new(ufraw_batch_develop_stage, pipeline,
+                                          1, TRUE, NULL);
+    pipeline->encode = g_thread_pool_new(ufraw_batch_encode_stage, pipeline,
+                                         jobs, TRUE, NULL);
+}
+
+/* All jobs must be finished */
+static void ufraw_batch_pipeline_free(batch_pipeline *pipeline)
+{
+    g_thread_pool_free(pipeline->load, FALSE, TRUE);
+    g_thread_pool_free(pipeline->develop, FALSE, TRUE);
+    g_thread_pool_free(pipeline->encode, FALSE, TRUE);
+    g_async_queue_unref(pipeline->finished);
+}
+
+/* Show the held messages of the jobs which are done and whose previous
+ * jobs were all shown. Returns 1 if any of them failed. */
+static int ufraw_batch_job_show(batch_job *job, int count, int *shown)
+{
+    int exitCode = 0;
+    guint i;
+
+    for (; *shown < count && job[*shown].done; (*shown)++) {
+        ufraw_context *context = job[*shown].context;
+        for (i = 0; i < context->heldMessages->len; i++)
+            ufraw_messenger(g_ptr_array_index(context->heldMessages, i), NULL);
+        ufraw_batch_timings_show(context, job[*shown].filename);
+        ufraw_context_free(context);
+        job[*shown].context = NULL;
+        exitCode |= job[*shown].exitCode;
+    }
+    return exitCode;
+}
+
+/* Print the stage timings of a file, if they were collected */
+static void ufraw_batch_timings_show(ufraw_context *context,
+                                     const char *filename)
+{
+    if (context->timings == NULL || filename[0] == '\0')
+        return;
+    gboolean json = timingsFormat == json_timings;
+    char *text = ufraw_timings_format(context->timings, filename, json);
+    g_printerr(json ? "%s\n" : "%s", text);
+    g_free(text);
+}
+
+/* Write the trace file, if a trace was recorded */
+static gboolean ufraw_batch_trace_close(void)
+{
+    GError *err = NULL;
+    if (ufraw_trace_close(&err))
+        return TRUE;
+    ufraw_message(UFRAW_ERROR, _("Error writing trace file: %s"),
+                  err->message);
+    g_error_free(err);
+    return FALSE;
+}
+
+/* Jobs running in parallel ask their questions one at a time */
+G_LOCK_DEFINE_STATIC(overwrite_question);
+
 int ufraw_batch_saver(ufraw_data *uf)
+{
+    int status = ufraw_batch_prepare_output(uf);
+    if (status != UFRAW_SUCCESS) return status;
+    return ufraw_batch_write(uf, FALSE);
+}
+
+/* Ask before overwriting an existing file and make the output filename
+ * absolute. */
+static int ufraw_batch_prepare_output(ufraw_data *uf)
 {
     if (!uf->conf->overwrite && uf->conf->createID != only_id
             && strcmp(uf->conf->outputFilename, "-")
             && g_file_test(uf->conf->outputFilename, G_FILE_TEST_EXISTS)) {
         char ans[max_name];
+        G_LOCK(overwrite_question);
         /* First letter of the word 'yes' for the y/n question */
         gchar *yChar = g_utf8_strdown(_("y"), -1);
         /* First letter of the word 'no' for the y/n question */
@@ -129,6 +428,7 @@ int ufraw_batch_saver(ufraw_data *uf)
             g_printerr(" [%s/%s] ", yChar, nChar);
             if (fgets(ans, max_name, stdin) == NULL) ans[0] = '\0';
         }
+        G_UNLOCK(overwrite_question);
         gchar *ans8 = g_utf8_strdown(ans, 1);
         if (g_utf8_collate(ans8, yChar) != 0) {
             g_free(yChar);
@@ -145,14 +445,22 @@ int ufraw_batch_saver(ufraw_data *uf)
         g_strlcpy(uf->conf->outputFilename, absname, max_path);
         g_free(absname);
     }
+    return UFRAW_SUCCESS;
+}
+
+/* Write the output file. If 'converted' is set, the image was already
+ * developed by ufraw_convert_image() or ufraw_convert_embedded(). */
+static int ufraw_batch_write(ufraw_data *uf, gboolean converted)
+{
     if (uf->conf->embeddedImage) {
-        int status = ufraw_convert_embedded(uf);
+        int status = converted ? UFRAW_SUCCESS : ufraw_convert_embedded(uf);
         if (status != UFRAW_SUCCESS) return status;
         status = ufraw_write_embedded(uf);
         return status;
     } else {
 
-        int status = ufraw_write_image(uf);
+        int status = converted ? ufraw_write_converted_image(uf) :
+                     ufraw_write_image(uf);
         if (status != UFRAW_SUCCESS)
             ufraw_message(status, ufraw_get_message(uf));
         return status;
@@ -0,0 +1,658 @@
+/*
+ * UFRaw - Unidentified Flying Raw converter for digital camera images
+ *
+ * ufraw-bench.c - Benchmark of the conversion kernels on synthetic images.
+ * Copyright 2026 by the UFRaw developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "ufraw.h"
+#include "dcraw_api.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <glib/gstdio.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/*
+ * ufraw-bench times each kernel of the conversion on synthetic mosaics,
+ * so that no camera files are needed and the results are reproducible.
+ * Each mosaic is written as a minimal uncompressed DNG and goes through
+ * the same dcraw parsing and loading code as a real raw file. Every
+ * kernel is run a few times to warm up and then repeatedly, reporting
+ * the throughput of the median run and of the 95th percentile (slow)
+ * run in megapixels per second.
+ */
+
+char *ufraw_binary;
+
+/* Not part of the dcraw API, see dcraw_indi.c */
+void color_smooth(guint16(*image)[4], const int width, const int height,
+                  const int passes);
+
+typedef struct {
+    const char *name;
+    int cfaWidth, cfaHeight;
+    /* DNG CFA colors: 0 red, 1 green, 2 blue, 3 cyan, 4 magenta, 5 yellow */
+    guint8 cfa[36];
+    int colors;
+} bench_mosaic;
+
+static const bench_mosaic benchMosaics[] = {
+    { "bayer", 2, 2, { 0, 1, 1, 2 }, 3 },
+    {
+        "xtrans", 6, 6, {
+            1, 1, 0, 1, 1, 2,
+            1, 1, 2, 1, 1, 0,
+            2, 0, 1, 0, 2, 1,
+            1, 1, 2, 1, 1, 0,
+            1, 1, 0, 1, 1, 2,
+            0, 2, 1, 2, 0, 1
+        }, 3
+    },
+    /* CYGM, as in the Canon PowerShot cameras */
+    { "4color", 2, 4, { 1, 4, 3, 5, 4, 1, 3, 5 }, 4 }
+};
+#define bench_mosaics_num (int)(sizeof benchMosaics / sizeof benchMosaics[0])
+
+static int benchWidth = 3000, benchHeight = 2000;
+static int benchWarmup = 1, benchRepeat = 7;
+
+/* State shared by the kernel benchmarks of one mosaic */
+typedef struct {
+    const bench_mosaic *mosaic;
+    dcraw_data *raw;
+    dcraw_image_type *rawCopy;
+    int interpolation;
+    dcraw_image_data image, work;
+    int smoothPasses;
+    ufraw_data *uf;
+    guint8 *developBuffer;
+    int developDepth;
+} bench_state;
+
+typedef void (*bench_func)(bench_state *s);
+
+void ufraw_messenger(char *message, void *parentWindow)
+{
+    (void)parentWindow;
+    ufraw_batch_messenger(message);
+}
+
+static void put16(guint8 *p, unsigned v)
+{
+    p[0] = v & 0xff;
+    p[1] = v >> 8 & 0xff;
+}
+
+static void put32(guint8 *p, unsigned v)
+{
+    put16(p, v & 0xffff);
+    put16(p + 2, v >> 16);
+}
+
+/* Minimal little endian TIFF writer, entries must be added by tag order */
+typedef struct {
+    guint8 *buf;
+    int entries;
+    size_t extra;
+} bench_tiff;
+
+#define TIFF_IFD_ENTRIES 20
+#define TIFF_EXTRA (8 + 2 + TIFF_IFD_ENTRIES * 12 + 4)
+#define TIFF_DATA 4096
+
+static void tiff_entry(bench_tiff *t, int tag, int type, int count,
+                       const void *values)
+{
+    static const int typeSize[] = { 0, 1, 1, 2, 4, 8, 0, 0, 0, 0, 8 };
+    guint8 *entry = t->buf + 10 + t->entries++ * 12;
+    int size = typeSize[type] * count, i;
+    guint8 *p;
+
+    g_assert(t->entries <= TIFF_IFD_ENTRIES);
+    put16(entry, tag);
+    put16(entry + 2, type);
+    put32(entry + 4, count);
+    if (size <= 4) {
+        p = entry + 8;
+    } else {
+        put32(entry + 8, t->extra);
+        p = t->buf + t->extra;
+        t->extra += (size + 1) & ~1;
+        g_assert(t->extra <= TIFF_DATA);
+    }
+    for (i = 0; i < count; i++) {
+        if (type == 1 || type == 2)
+            p[i] = ((const guint8 *)values)[i];
+        else if (type == 3)
+            put16(p + i * 2, ((const guint16 *)values)[i]);
+        else if (type == 4)
+            put32(p + i * 4, ((const guint32 *)values)[i]);
+        else {
+            put32(p + i * 8, ((const gint32 *)values)[2 * i]);
+            put32(p + i * 8 + 4, ((const gint32 *)values)[2 * i + 1]);
+        }
+    }
+}
+
+/* The scene is a mix of smooth gradients, sharp edges, fine detail and
+ * noise, in linear RGB between 0 and 1. The noise is pseudo random,
+ * so that the images are the same on every run. */
+static void bench_scene(int x, int y, guint32 *seed, float rgb[3])
+{
+    float nx = (float)x / benchWidth, ny = (float)y / benchHeight;
+    float edge = ((x / 97 + y / 89) & 1) ? 1.0 : 0.55;
+    float ring = 0.5 + 0.5 * cos(sqrt((nx - 0.5) * (nx - 0.5) +
+                                      (ny - 0.5) * (ny - 0.5)) * 180);
+    int c;
+
+    rgb[0] = 0.15 + 0.6 * nx * edge;
+    rgb[1] = 0.15 + 0.5 * ny * edge + 0.15 * ring;
+    rgb[2] = 0.15 + 0.35 * (1 - nx) * edge + 0.3 * ring * ny;
+    for (c = 0; c < 3; c++) {
+        *seed = *seed * 1103515245 + 12345;
+        rgb[c] *= 0.98 + 0.04 * (*seed >> 16 & 0x7fff) / 0x7fff;
+    }
+}
+
+/* Return a synthetic DNG of the given mosaic, to be freed with g_free() */
+static guint8 *bench_dng_new(const bench_mosaic *m, size_t *size)
+{
+    const int white = 16383;
+    /* XYZ to linear sRGB, which is our camera RGB */
+    static const float xyzRgb[3][3] = {
+        {  3.2406, -1.5372, -0.4986 },
+        { -0.9689,  1.8758,  0.0415 },
+        {  0.0557, -0.2040,  1.0570 }
+    };
+    /* Camera colors in the dcraw order of the 4 color CFA in terms of RGB:
+     * yellow, cyan, magenta, green. */
+    static const float cmygRgb[4][3] = {
+        { 0.5, 0.5, 0 }, { 0, 0.5, 0.5 }, { 0.5, 0, 0.5 }, { 0, 1, 0 }
+    };
+    bench_tiff t;
+    gint32 colorMatrix[4 * 3 * 2], neutral[4 * 2];
+    guint32 seed = 1;
+    int row, col, c, i;
+
+    *size = TIFF_DATA + (size_t)benchWidth * benchHeight * 2;
+    t.buf = g_new0(guint8, *size);
+    t.entries = 0;
+    t.extra = TIFF_EXTRA;
+    memcpy(t.buf, "II*\0", 4);
+    put32(t.buf + 4, 8);
+
+    for (row = 0; row < benchHeight; row++) {
+        guint8 *p = t.buf + TIFF_DATA + (size_t)row * benchWidth * 2;
+        for (col = 0; col < benchWidth; col++) {
+            float rgb[3], v;
+            bench_scene(col, row, &seed, rgb);
+            switch (m->cfa[row % m->cfaHeight * m->cfaWidth +
+                           col % m->cfaWidth]) {
+            case 0: v = rgb[0]; break;
+            case 1: v = rgb[1]; break;
+            case 2: v = rgb[2]; break;
+            case 3: v = (rgb[1] + rgb[2]) / 2; break;
+            case 4: v = (rgb[0] + rgb[2]) / 2; break;
+            default: v = (rgb[0] + rgb[1]) / 2; break;
+            }
+            put16(p + col * 2, LIM(v, 0, 1) * white);
+        }
+    }
+    for (c = 0; c < m->colors; c++) {
+        for (i = 0; i < 3; i++) {
+            float v = 0;
+            int j;
+            for (j = 0; j < 3; j++)
+                v += (m->colors == 4 ? cmygRgb[c][j] : c == j) * xyzRgb[j][i];
+            colorMatrix[(c * 3 + i) * 2] = floor(v * 10000 + 0.5);
+            colorMatrix[(c * 3 + i) * 2 + 1] = 10000;
+        }
+        neutral[c * 2] = neutral[c * 2 + 1] = 1;
+    }
+    guint32 zero = 0, width = benchWidth, height = benchHeight;
+    guint32 offset = TIFF_DATA, bytes = *size - TIFF_DATA, level = white;
+    guint16 bps = 16, compression = 1, cfa = 32803, one = 1;
+    guint16 dim[2] = { m->cfaHeight, m->cfaWidth };
+    char model[max_name];
+    g_snprintf(model, max_name, "Synthetic %s", m->name);
+    tiff_entry(&t, 254, 4, 1, &zero);		/* NewSubFileType */
+    tiff_entry(&t, 256, 4, 1, &width);
+    tiff_entry(&t, 257, 4, 1, &height);
+    tiff_entry(&t, 258, 3, 1, &bps);
+    tiff_entry(&t, 259, 3, 1, &compression);
+    tiff_entry(&t, 262, 3, 1, &cfa);		/* PhotometricInterpretation */
+    tiff_entry(&t, 271, 2, 6, "UFRaw");
+    tiff_entry(&t, 272, 2, strlen(model) + 1, model);
+    tiff_entry(&t, 273, 4, 1, &offset);		/* StripOffsets */
+    tiff_entry(&t, 277, 3, 1, &one);		/* SamplesPerPixel */
+    tiff_entry(&t, 278, 4, 1, &height);		/* RowsPerStrip */
+    tiff_entry(&t, 279, 4, 1, &bytes);		/* StripByteCounts */
+    tiff_entry(&t, 284, 3, 1, &one);		/* PlanarConfiguration */
+    tiff_entry(&t, 33421, 3, 2, dim);		/* CFARepeatPatternDim */
+    tiff_entry(&t, 33422, 1, m->cfaWidth * m->cfaHeight, m->cfa);
+    tiff_entry(&t, 50706, 1, 4, "\1\4\0\0");	/* DNGVersion */
+    tiff_entry(&t, 50717, 4, 1, &level);	/* WhiteLevel */
+    tiff_entry(&t, 50721, 10, m->colors * 3, colorMatrix);
+    tiff_entry(&t, 50728, 5, m->colors, neutral);	/* AsShotNeutral */
+    put16(t.buf + 8, t.entries);
+    put32(t.buf + 10 + t.entries * 12, 0);
+    return t.buf;
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Run setup() and kernel() benchWarmup + benchRepeat times, timing only
+ * kernel(), and report the throughput for pixels in Mpix/s. */
+static void bench_run(const char *name, bench_state *s, bench_func setup,
+                      bench_func kernel, double pixels)
+{
+    double *times = g_new(double, benchRepeat);
+    GTimer *timer = g_timer_new();
+    int i;
+
+    for (i = -benchWarmup; i < benchRepeat; i++) {
+        if (setup != NULL)
+            setup(s);
+        g_timer_start(timer);
+        kernel(s);
+        g_timer_stop(timer);
+        if (i >= 0)
+            times[i] = g_timer_elapsed(timer, NULL);
+    }
+    qsort(times, benchRepeat, sizeof(double), bench_compare);
+    double median = times[benchRepeat / 2];
+    double p95 = times[MIN((benchRepeat * 95 + 99) / 100, benchRepeat) - 1];
+    printf("%-8s %-26s %10.2f %10.2f\n", s->mosaic->name, name,
+           pixels / 1e6 / median, pixels / 1e6 / p95);
+    fflush(stdout);
+    g_timer_destroy(timer);
+    g_free(times);
+}
+
+static void bench_restore_raw(bench_state *s)
+{
+    memcpy(s->raw->raw.image, s->rawCopy, (size_t)s->raw->raw.height *
+           s->raw->raw.width * sizeof(dcraw_image_type));
+}
+
+static void bench_copy_image(bench_state *s)
+{
+    size_t size = (size_t)s->image.height * s->image.width *
+                  sizeof(dcraw_image_type);
+    s->work.image = g_realloc(s->work.image, size);
+    memcpy(s->work.image, s->image.image, size);
+    s->work.width = s->image.width;
+    s->work.height = s->image.height;
+    s->work.colors = s->image.colors;
+}
+
+static void bench_finalize_raw(bench_state *s)
+{
+    int rgbWB[4] = { 0x10000, 0x10000, 0x10000, 0x10000 };
+    dcraw_finalize_raw(s->raw, NULL, rgbWB);
+}
+
+static void bench_wavelet_denoise(bench_state *s)
+{
+    dcraw_wavelet_denoise(s->raw, 100);
+}
+
+static void bench_wavelet_denoise_shrinked(bench_state *s)
+{
+    dcraw_wavelet_denoise_shrinked(&s->work, 100);
+}
+
+static void bench_interpolate(bench_state *s)
+{
+    dcraw_finalize_interpolate(&s->work, s->raw, s->interpolation, FALSE);
+}
+
+static void bench_color_smooth(bench_state *s)
+{
+    color_smooth(s->work.image, s->work.width, s->work.height,
+                 s->smoothPasses);
+}
+
+static void bench_resize(bench_state *s)
+{
+    dcraw_image_resize(&s->work, MAX(s->work.width, s->work.height) / 2);
+}
+
+static void bench_flip(bench_state *s)
+{
+    dcraw_flip_image(&s->work, 6);
+}
+
+static void bench_develop(bench_state *s)
+{
+    ufraw_image_data *img = &s->uf->Images[ufraw_first_phase];
+    ufraw_image_type *image = (ufraw_image_type *)img->buffer;
+    int byteDepth = (s->developDepth + 7) / 8;
+    int row;
+
+#ifdef _OPENMP
+    #pragma omp parallel for default(shared) private(row)
+#endif
+    for (row = 0; row < img->height; row++)
+        develop(s->developBuffer + (size_t)row * img->width * 3 * byteDepth,
+                image[row * img->width], s->uf->developer, s->developDepth,
+                img->width);
+}
+
+/* Benchmark develop() and the row writers through ufraw_data, using the
+ * stage timings to separate the encoding from the developing. */
+static void bench_writers(bench_state *s, const char *dngFilename)
+{
+    static const struct {
+        const char *name;
+        int type, bitDepth;
+    } writers[] = {
+        { "ppm", ppm_type, 8 }, { "ppm", ppm_type, 16 },
+#ifdef HAVE_LIBTIFF
+        { "tiff", tiff_type, 8 }, { "tiff", tiff_type, 16 },
+#endif
+#ifdef HAVE_LIBJPEG
+        { "jpeg", jpeg_type, 8 },
+#endif
+#ifdef HAVE_LIBPNG
+        { "png", png_type, 8 }, { "png", png_type, 16 },
+#endif
+    };
+    ufraw_context *context = ufraw_context_new();
+    conf_data rc;
+    int w, i;
+
+    context->timings = ufraw_timings_new();
+    ufraw_context_set(context);
+    conf_init(&rc);
+    rc.ufobject = ufraw_resources_new();
+    s->uf = ufraw_open((char *)dngFilename);
+    if (s->uf == NULL || ufraw_config(s->uf, &rc, NULL, NULL) != UFRAW_SUCCESS
+            || ufraw_load_raw(s->uf) != UFRAW_SUCCESS
+            || ufraw_convert_image(s->uf) != UFRAW_SUCCESS) {
+        ufraw_message(UFRAW_REPORT, NULL);
+        g_printerr("%s: could not convert the %s image\n", ufraw_binary,
+                   s->mosaic->name);
+        ufraw_context_set(NULL);
+        ufraw_context_free(context);
+        return;
+    }
+    ufraw_image_data *img = &s->uf->Images[ufraw_first_phase];
+    double pixels = (double)img->width * img->height;
+
+    s->developBuffer = g_new(guint8, (size_t)img->width * img->height * 6);
+    s->developDepth = 8;
+    bench_run("develop 8-bit", s, NULL, bench_develop, pixels);
+    s->developDepth = 16;
+    bench_run("develop 16-bit", s, NULL, bench_develop, pixels);
+
+    /* Saturate the green channel of every pixel and apply a negative
+     * exposure, so that the highlights of the whole frame are restored. */
+    conf_data *conf = s->uf->conf;
+    ufraw_image_type *image = (ufraw_image_type *)img->buffer;
+    size_t size = (size_t)img->width * img->height * sizeof(ufraw_image_type);
+    ufraw_image_type *imageCopy = g_memdup(image, size);
+    double exposure = conf->exposure;
+    int restoreDetails = conf->restoreDetails;
+    int clipHighlights = conf->clipHighlights;
+    for (i = 0; i < img->width * img->height; i++)
+        image[i][1] = 0xFFFF;
+    conf->exposure = -1;
+    conf->restoreDetails = restore_lch_details;
+    conf->clipHighlights = digital_highlights;
+    ufraw_developer_prepare(s->uf, file_developer);
+    bench_run("develop clipped lch", s, NULL, bench_develop, pixels);
+    memcpy(image, imageCopy, size);
+    g_free(imageCopy);
+    conf->exposure = exposure;
+    conf->restoreDetails = restoreDetails;
+    conf->clipHighlights = clipHighlights;
+    ufraw_developer_prepare(s->uf, file_developer);
+    g_free(s->developBuffer);
+
+    for (w = 0; w < (int)(sizeof writers / sizeof writers[0]); w++) {
+        double *times = g_new(double, benchRepeat);
+        char name[max_name], type[max_name];
+
+        conf->type = writers[w].type;
+        conf->profile[out_profile][conf->profileIndex[out_profile]].BitDepth =
+            writers[w].bitDepth;
+        conf->createID = no_id;
+        g_snprintf(type, max_name, "-%d.%s", writers[w].bitDepth,
+                   writers[w].name);
+        char *outFilename = uf_file_set_type(dngFilename, type);
+        g_strlcpy(conf->outputFilename, outFilename, max_path);
+        for (i = -benchWarmup; i < benchRepeat; i++) {
+            double start = ufraw_timings_wall(context->timings, TIMING_ENCODE);
+            if (ufraw_write_converted_image(s->uf) != UFRAW_SUCCESS) {
+                g_printerr("%s: %s\n", ufraw_binary,
+                           ufraw_get_message(s->uf));
+                break;
+            }
+            if (i >= 0)
+                times[i] = ufraw_timings_wall(context->timings, TIMING_ENCODE)
+                           - start;
+        }
+        g_unlink(outFilename);
+        g_free(outFilename);
+        if (i == benchRepeat) {
+            /* Report the same way as bench_run() */
+            qsort(times, benchRepeat, sizeof(double), bench_compare);
+            double median = times[benchRepeat / 2];
+            double p95 = times[MIN((benchRepeat * 95 + 99) / 100,
+                                   benchRepeat) - 1];
+            g_snprintf(name, max_name, "%s_row_writer %d-bit",
+                       writers[w].name, writers[w].bitDepth);
+            printf("%-8s %-26s %10.2f %10.2f\n", s->mosaic->name, name,
+                   pixels / 1e6 / median, pixels / 1e6 / p95);
+            fflush(stdout);
+        }
+        g_free(times);
+    }
+    ufraw_close_darkframe(s->uf->conf);
+    ufraw_close(s->uf);
+    g_free(s->uf);
+    s->uf = NULL;
+    ufobject_delete(rc.ufobject);
+    ufraw_context_set(NULL);
+    ufraw_context_free(context);
+}
+
+static void bench_mosaic_run(const bench_mosaic *m)
+{
+    static const struct {
+        const char *name;
+        int interpolation;
+    } interpolations[] = {
+        { "ahd", dcraw_ahd_interpolation },
+        { "vng", dcraw_vng_interpolation },
+        { "four_color", dcraw_four_color_interpolation },
+        { "ppg", dcraw_ppg_interpolation },
+        { "bilinear", dcraw_bilinear_interpolation },
+        { "xtrans", dcraw_xtrans_interpolation }
+    };
+    bench_state s;
+    size_t size;
+    int i, status;
+    GError *err = NULL;
+    char *dngFilename;
+
+    memset(&s, 0, sizeof s);
+    s.mosaic = m;
+    guint8 *dng = bench_dng_new(m, &size);
+    int fd = g_file_open_tmp("ufraw-bench-XXXXXX.dng", &dngFilename, &err);
+    if (fd < 0 || (close(fd), !g_file_set_contents(dngFilename,
+                   (char *)dng, size, &err))) {
+        g_printerr("%s: %s\n", ufraw_binary, err->message);
+        g_error_free(err);
+        g_free(dng);
+        return;
+    }
+
+    s.raw = g_new(dcraw_data, 1);
+    status = dcraw_open_buffer(s.raw, dngFilename, dng, size);
+    if (status == DCRAW_SUCCESS || status == DCRAW_WARNING)
+        status = dcraw_load_raw(s.raw);
+    if (status != DCRAW_SUCCESS && status != DCRAW_WARNING) {
+        g_printerr("%s: %s", ufraw_binary, s.raw->message);
+        g_free(s.raw);
+        g_free(dng);
+        g_unlink(dngFilename);
+        g_free(dngFilename);
+        return;
+    }
+    dcraw_data *raw = s.raw;
+    gboolean xtrans = raw->filters == 9;
+    double pixels = (double)raw->width * raw->height;
+    size_t rawSize = (size_t)raw->raw.height * raw->raw.width *
+                     sizeof(dcraw_image_type);
+    s.rawCopy = g_memdup(raw->raw.image, rawSize);
+
+    bench_run("dcraw_finalize_raw", &s, bench_restore_raw,
+              bench_finalize_raw, pixels);
+    if (!xtrans)
+        bench_run("wavelet_denoise_INDI", &s, bench_restore_raw,
+                  bench_wavelet_denoise, pixels);
+    /* The interpolations start from a finalized raw image */
+    bench_restore_raw(&s);
+    bench_finalize_raw(&s);
+    for (i = 0; i < (int)G_N_ELEMENTS(interpolations); i++) {
+        int interpolation = interpolations[i].interpolation;
+        /* X-Trans images are only interpolated by xtrans_interpolate_INDI */
+        if (xtrans != (interpolation == dcraw_xtrans_interpolation))
+            continue;
+        /* Four color images are always interpolated by VNG */
+        if (raw->colors == 4 && interpolation != dcraw_four_color_interpolation)
+            continue;
+        char name[max_name];
+        g_snprintf(name, max_name, "%s_interpolate_INDI",
+                   interpolation == dcraw_four_color_interpolation ? "vng" :
+                   interpolations[i].name);
+        if (interpolation == dcraw_four_color_interpolation)
+            g_strlcat(name, " 4c", max_name);
+        s.interpolation = interpolation;
+        bench_run(name, &s, NULL, bench_interpolate, pixels);
+    }
+    /* The remaining kernels work on the image interpolated as ufraw does */
+    s.interpolation = xtrans ? dcraw_xtrans_interpolation :
+                      raw->colors == 4 ? dcraw_four_color_interpolation :
+                      dcraw_ahd_interpolation;
+    s.smoothPasses = raw->colors == 4 ? 1 : 3;
+    dcraw_finalize_interpolate(&s.image, raw, s.interpolation, FALSE);
+    pixels = (double)s.image.width * s.image.height;
+    bench_run("color_smooth", &s, bench_copy_image, bench_color_smooth,
+              pixels);
+    if (xtrans)
+        bench_run("wavelet_denoise_shrinked", &s, bench_copy_image,
+                  bench_wavelet_denoise_shrinked, pixels);
+    bench_run("dcraw_image_resize", &s, bench_copy_image, bench_resize,
+              pixels);
+    bench_run("flip_image_INDI", &s, bench_copy_image, bench_flip, pixels);
+    g_free(s.image.image);
+    g_free(s.work.image);
+    g_free(s.rawCopy);
+    dcraw_close(s.raw);
+    g_free(s.raw);
+    g_free(dng);
+
+    bench_writers(&s, dngFilename);
+    g_unlink(dngFilename);
+    g_free(dngFilename);
+}
+
+static void bench_usage(void)
+{
+    g_print("Usage: %s [OPTIONS]\n\n"
+            "Benchmark the UFRaw conversion kernels on synthetic images.\n\n"
+            "--size=WxH       Size of the synthetic raw images "
+            "(default 3000x2000).\n"
+            "--mosaic=NAME    bayer, xtrans, 4color or all (default all).\n"
+            "--warmup=N       Untimed runs of each kernel (default 1).\n"
+            "--repeat=N       Timed runs of each kernel (default 7).\n"
+            "--help           Display this help and exit.\n\n"
+            "The throughput is reported in Mpix/s for the median run and for\n"
+            "the 95th percentile run, which is the slower one.\n",
+            ufraw_binary);
+}
+
+int main(int argc, char **argv)
+{
+    static const struct option options[] = {
+        { "size", 1, 0, 's'},
+        { "mosaic", 1, 0, 'm'},
+        { "warmup", 1, 0, 'w'},
+        { "repeat", 1, 0, 'r'},
+        { "help", 0, 0, 'h'},
+        { 0, 0, 0, 0}
+    };
+    const char *mosaicName = "all";
+    int c, i, found = FALSE;
+
+#if !GLIB_CHECK_VERSION(2,31,0)
+    g_thread_init(NULL);
+#endif
+    ufraw_binary = g_path_get_basename(argv[0]);
+    uf_init_locale(argv[0]);
+    while ((c = getopt_long(argc, argv, "h", options, NULL)) != -1) {
+        switch (c) {
+        case 's':
+            if (sscanf(optarg, "%dx%d", &benchWidth, &benchHeight) != 2 ||
+                    benchWidth < 64 || benchHeight < 64) {
+                g_printerr("%s: '%s' is not a valid size.\n", ufraw_binary,
+                           optarg);
+                exit(1);
+            }
+            break;
+        case 'm':
+            mosaicName = optarg;
+            break;
+        case 'w':
+            benchWarmup = MAX(atoi(optarg), 0);
+            break;
+        case 'r':
+            benchRepeat = MAX(atoi(optarg), 1);
+            break;
+        case 'h':
+            bench_usage();
+            exit(0);
+        default:
+            bench_usage();
+            exit(1);
+        }
+    }
+    int threads = 1;
+#ifdef _OPENMP
+    threads = omp_get_max_threads();
+#endif
+    printf("# ufraw-bench " VERSION ", %dx%d, %d warm-up and %d timed runs, "
+           "%d threads\n", benchWidth, benchHeight, benchWarmup, benchRepeat,
+           threads);
+    printf("%-8s %-26s %10s %10s\n", "# mosaic", "kernel", "median", "p95");
+    for (i = 0; i < bench_mosaics_num; i++) {
+        if (strcmp(mosaicName, "all") != 0 &&
+                strcmp(mosaicName, benchMosaics[i].name) != 0)
+            continue;
+        found = TRUE;
+        bench_mosaic_run(&benchMosaics[i]);
+    }
+    if (!found) {
+        g_printerr("%s: '%s' is not a valid mosaic.\n", ufraw_binary,
+                   mosaicName);
+        exit(1);
+    }
+    exit(0);
+}
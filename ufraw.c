@@ -73,6 +73,21 @@ int main(int argc, char **argv)
                       _("The --silent option is only valid with 'ufraw-batch'"));
         optInd = -1;
     }
+    if (cmd.jobs != -1) {
+        ufraw_message(UFRAW_ERROR,
+                      _("The --jobs option is only valid with 'ufraw-batch'"));
+        optInd = -1;
+    }
+    if (cmd.timings != -1) {
+        ufraw_message(UFRAW_ERROR,
+                      _("The --timings option is only valid with 'ufraw-batch'"));
+        optInd = -1;
+    }
+    if (strlen(cmd.traceFilename) > 0) {
+        ufraw_message(UFRAW_ERROR,
+                      _("The --trace option is only valid with 'ufraw-batch'"));
+        optInd = -1;
+    }
     if (cmd.embeddedImage) {
         ufraw_message(UFRAW_ERROR,
                       _("The --embedded-image option is only valid with 'ufraw-batch'"));
@@ -119,6 +119,7 @@ enum { ahd_interpolation, vng_interpolation, four_color_interpolation,
        num_interpolations
      };
 enum { no_id, also_id, only_id, send_id };
+enum { no_timings, table_timings, json_timings };
 enum { manual_curve, linear_curve, custom_curve, camera_curve };
 enum { in_profile, out_profile, display_profile, profile_types};
 enum { raw_expander, live_expander, expander_count };
@@ -172,16 +173,27 @@ typedef struct {
     double gamma, linear;
     char profileFile[profile_types][max_path];
     void *profile[profile_types];
+    const struct _uf_profile *registeredProfile[profile_types];
     Intent intent[profile_types];
     gboolean updateTransform;
     void *colorTransform;
+    int colorLutSize;
+    guint16 *colorLut;
+    void *colorShaper;
     void *working2displayTransform;
     void *rgbtolabTransform;
+    gboolean floatOutput;
+    void *floatTransform;
+    gint32 *linearLut;
+    guint32 clipLimit[4];
+    gboolean linearLutGamma;
     double saturation;
 #ifdef UFRAW_CONTRAST
     double contrast;
 #endif
     CurveData baseCurveData, luminosityCurveData;
+    /* gammaCurve[i] = gammaTable[baseCurve[filmCurve[i]]] */
+    guint16 baseCurve[0x10000], filmCurve[0x10000], gammaTable[0x10000];
     guint16 gammaCurve[0x10000];
     void *luminosityProfile;
     void *TransferFunction[3];
@@ -286,6 +298,7 @@ typedef struct {
     int shrink, size;
     gboolean overwrite, losslessCompress, embeddedImage, noExit;
     gboolean rotate;
+    int colorLut;
 
     /* GUI settings */
     double Zoom;
@@ -301,6 +314,9 @@ typedef struct {
     char curvePath[max_path];
     char profilePath[max_path];
     gboolean silent;
+    int jobs;
+    int timings;
+    char traceFilename[max_path];
     char remoteGimpCommand[max_path];
 
     /* EXIF data */
@@ -329,9 +345,32 @@ typedef struct {
     gboolean invalidate_event;
 } ufraw_image_data;
 
+/* State of the old message handling and of the progress reporting, which
+ * used to be process global. Each thread can make a context current with
+ * ufraw_context_set(), threads without one share a default context.
+ * An ufraw_data keeps the context it was opened in and makes it current
+ * again during ufraw_config(), ufraw_load_raw(), ufraw_convert_image()
+ * and ufraw_write_image(), so these can run on any thread. */
+typedef struct _ufraw_timings ufraw_timings;
+
+typedef struct {
+    char *logBuffer;
+    char *errorBuffer;
+    gboolean errorFlag;
+    void (*progress)(int what, int ticks);
+    /* If set, messages are kept here instead of being passed to
+     * ufraw_messenger(), so that they can be shown later in order. */
+    GPtrArray *heldMessages;
+    /* If set, the stages of the conversion are timed, see uf_progress.h. */
+    ufraw_timings *timings;
+    /* Last message of libtiff, which has no per file message handlers. */
+    char tiffMessage[max_path];
+} ufraw_context;
+
 typedef struct ufraw_struct {
     int status;
     char *message;
+    ufraw_context *context;
     char filename[max_path];
     int initialHeight, initialWidth, rgbMax, colors, raw_color, useMatrix;
     int rotatedHeight, rotatedWidth;
@@ -433,8 +472,23 @@ int ufraw_get_status(ufraw_data *uf);
 int ufraw_is_error(ufraw_data *uf);
 // Old error handling, should be removed after being fully implemented.
 char *ufraw_message(int code, const char *format, ...);
+ufraw_context *ufraw_context_new(void);
+void ufraw_context_free(ufraw_context *context);
+ufraw_context *ufraw_context_set(ufraw_context *context);
+ufraw_context *ufraw_context_get(void);
+ufraw_context *ufraw_context_current(void);
 void ufraw_batch_messenger(char *message);
 
+/* prototypes for functions in ufraw_timings.c */
+ufraw_timings *ufraw_timings_new(void);
+void ufraw_timings_free(ufraw_timings *timings);
+char *ufraw_timings_format(ufraw_timings *timings, const char *filename,
+                           gboolean json);
+double ufraw_timings_wall(ufraw_timings *timings, int stage);
+void ufraw_trace_open(const char *filename);
+gboolean ufraw_trace_close(GError **error);
+void ufraw_trace_thread_name(const char *name);
+
 /* prototypes for functions in ufraw_preview.c */
 int ufraw_preview(ufraw_data *uf, conf_data *rc, int plugin,
                   long(*save_func)());
@@ -495,6 +549,7 @@ void developer_prepare(developer_data *d, conf_data *conf,
 void develop(void *po, guint16 pix[4], developer_data *d, int mode, int count);
 void develop_display(void *pout, void *pin, developer_data *d, int count);
 void develop_linear(guint16 in[4], guint16 out[3], developer_data *d);
+void develop_float(float *out, guint16 pix[4], developer_data *d, int count);
 
 /* prototype for functions in ufraw_saver.c */
 long ufraw_save_now(ufraw_data *uf, void *widget);
@@ -502,6 +557,7 @@ long ufraw_send_to_gimp(ufraw_data *uf);
 
 /* prototype for functions in ufraw_writer.c */
 int ufraw_write_image(ufraw_data *uf);
+int ufraw_write_converted_image(ufraw_data *uf);
 void ufraw_write_image_data(
     ufraw_data *uf, void * volatile out,
     const UFRectangle *Crop, int bitDepth, int grayscaleMode,
@@ -523,6 +579,7 @@ void ufraw_chooser(conf_data *conf, conf_data *rc, conf_data *cmd,
 void ufraw_icons_init();
 
 /* prototype for functions in ufraw_exiv2.cc */
+void ufraw_exif_init(void);
 int ufraw_exif_read_input(ufraw_data *uf);
 int ufraw_exif_prepare_output(ufraw_data *uf);
 int ufraw_exif_write(ufraw_data *uf);
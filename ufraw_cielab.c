@@ -0,0 +1,133 @@
+/*
+ * UFRaw - Unidentified Flying Raw converter for digital camera images
+ *
+ * ufraw_cielab.c - CIE-Lab conversion shared by the interpolation and
+ * the developer.
+ * Copyright 2026 by the UFRaw developers
+ *
+ * based on the CIE-Lab code of dcraw_indi.c and ufraw_developer.c
+ * by Udi Fuchs, and on dcraw by Dave Coffin
+ * http://www.cybercom.net/~dcoffin/
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "ufraw_cielab.h"
+#include <math.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static float cielab_cbrt[0x10000];
+
+const float *uf_cielab_cbrt_table(void)
+{
+    static gsize cbrtReady = 0;
+    int i;
+    float r;
+
+    if (g_once_init_enter(&cbrtReady)) {
+        for (i = 0; i < 0x10000; i++) {
+            r = i / 65535.0;
+            cielab_cbrt[i] = r > 0.008856 ? pow(r, 1 / 3.0) :
+                             7.787 * r + 16 / 116.0;
+        }
+        g_once_init_leave(&cbrtReady, 1);
+    }
+    return cielab_cbrt;
+}
+
+static void cielab_pixel(const guint16 rgb[3], gint16 lab[3], int colors,
+                         const float xyz_cam[3][4], const float *cbrt)
+{
+    int c;
+    float xyz[3];
+
+    xyz[0] = xyz[1] = xyz[2] = 0.5;
+    for (c = 0; c < colors; c++) {
+        xyz[0] += xyz_cam[0][c] * rgb[c];
+        xyz[1] += xyz_cam[1][c] * rgb[c];
+        xyz[2] += xyz_cam[2][c] * rgb[c];
+    }
+    for (c = 0; c < 3; c++)
+        xyz[c] = cbrt[MAX(MIN((int)xyz[c], 0xFFFF), 0)];
+    lab[0] = 64 * (116 * xyz[1] - 16);
+    lab[1] = 64 * 500 * (xyz[0] - xyz[1]);
+    lab[2] = 64 * 200 * (xyz[1] - xyz[2]);
+}
+
+#ifdef __SSE2__
+/* Four pixels at a time. The operations are done in the same order and
+ * precision as cielab_pixel(), so that the results are identical. The
+ * table lookups are the only scalar part, since SSE2 has no gather. */
+static int cielab_row_sse2(const guint16 (*rgb)[3], gint16 (*lab)[3],
+                           int count, const float xyz_cam[3][4],
+                           const float *cbrt)
+{
+    __m128 half = _mm_set1_ps(0.5), zero = _mm_setzero_ps();
+    __m128 top = _mm_set1_ps(65535);
+    __m128 m[3][3];
+    int i, j, c, k;
+
+    for (k = 0; k < 3; k++)
+        for (c = 0; c < 3; c++)
+            m[k][c] = _mm_set1_ps(xyz_cam[k][c]);
+    for (i = 0; i + 4 <= count; i += 4) {
+        const guint16 (*p)[3] = rgb + i;
+        __m128 ch[3], xyz[3];
+        int index[3][4];
+        gint32 out[3][4];
+        float f[3][4];
+
+        for (c = 0; c < 3; c++)
+            ch[c] = _mm_set_ps(p[3][c], p[2][c], p[1][c], p[0][c]);
+        for (k = 0; k < 3; k++) {
+            xyz[k] = half;
+            for (c = 0; c < 3; c++)
+                xyz[k] = _mm_add_ps(xyz[k], _mm_mul_ps(m[k][c], ch[c]));
+            /* Clamping before truncating gives the same index as
+             * clamping the truncated value. */
+            xyz[k] = _mm_min_ps(_mm_max_ps(xyz[k], zero), top);
+            _mm_storeu_si128((__m128i *)index[k], _mm_cvttps_epi32(xyz[k]));
+            for (j = 0; j < 4; j++)
+                f[k][j] = cbrt[index[k][j]];
+            xyz[k] = _mm_loadu_ps(f[k]);
+        }
+        _mm_storeu_si128((__m128i *)out[0], _mm_cvttps_epi32(
+                             _mm_mul_ps(_mm_set1_ps(64),
+                                        _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(116), xyz[1]),
+                                                _mm_set1_ps(16)))));
+        _mm_storeu_si128((__m128i *)out[1], _mm_cvttps_epi32(
+                             _mm_mul_ps(_mm_set1_ps(64 * 500),
+                                        _mm_sub_ps(xyz[0], xyz[1]))));
+        _mm_storeu_si128((__m128i *)out[2], _mm_cvttps_epi32(
+                             _mm_mul_ps(_mm_set1_ps(64 * 200),
+                                        _mm_sub_ps(xyz[1], xyz[2]))));
+        for (j = 0; j < 4; j++)
+            for (c = 0; c < 3; c++)
+                lab[i + j][c] = out[c][j];
+    }
+    return i;
+}
+#endif
+
+void uf_cielab_row(const guint16 (*rgb)[3], gint16 (*lab)[3], int count,
+                   int colors, const float xyz_cam[3][4])
+{
+    const float *cbrt = uf_cielab_cbrt_table();
+    int i = 0;
+
+#ifdef __SSE2__
+    if (colors == 3)
+        i = cielab_row_sse2(rgb, lab, count, xyz_cam, cbrt);
+#endif
+    for (; i < count; i++)
+        cielab_pixel(rgb[i], lab[i], colors, xyz_cam, cbrt);
+}
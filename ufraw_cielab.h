@@ -0,0 +1,38 @@
+/*
+ * UFRaw - Unidentified Flying Raw converter for digital camera images
+ *
+ * ufraw_cielab.h - CIE-Lab conversion shared by the interpolation and
+ * the developer.
+ * Copyright 2026 by the UFRaw developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _UFRAW_CIELAB_H
+#define _UFRAW_CIELAB_H
+
+#include <glib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The CIE-Lab function f(t), which is the cube root of t above the linear
+ * segment near black, for t = i / 65535. The table is filled on first use
+ * and then shared by all threads. */
+const float *uf_cielab_cbrt_table(void);
+
+/* Convert count pixels of the camera color space to CIE-Lab, with L, a
+ * and b multiplied by 64, as used by the homogeneity maps of the AHD and
+ * X-Trans interpolations. xyz_cam is normalized to the D65 white. */
+void uf_cielab_row(const guint16 (*rgb)[3], gint16 (*lab)[3], int count,
+                   int colors, const float xyz_cam[3][4]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*_UFRAW_CIELAB_H*/
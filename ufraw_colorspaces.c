@@ -1,7 +1,8 @@
 /*
  * UFRaw - Unidentified Flying Raw converter for digital camera images
  *
- * ufraw_colorspaces.c - Functions and data to create built-in color profiles.
+ * ufraw_colorspaces.c - Functions and data to create built-in color profiles,
+ * and the registry of the profiles in use.
  * Copyright 2004-2016 by Udi Fuchs
  *
  * This program is free software; you can redistribute it and/or modify
@@ -11,8 +12,11 @@
  */
 
 #include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
 #include <glib.h>
 #include <lcms2.h>
+#include "ufraw_colorspaces.h"
 
 static const uint16_t uf_srgb_tone_curve_values[] = {
     0,     5,     10,    15,    20,    25,    30,    35,    40,    45,    50,    55,    59,    64,    69,
@@ -145,3 +149,216 @@ cmsHPROFILE uf_colorspaces_create_srgb_profile()
 
     return hsRGB;
 }
+
+cmsHPROFILE uf_colorspaces_create_linear_profile(cmsHPROFILE profile)
+{
+    cmsHPROFILE hLinear;
+    cmsCIEXYZ *red, *green, *blue, *white;
+
+    if (cmsGetColorSpace(profile) != cmsSigRgbData ||
+            !cmsIsMatrixShaper(profile))
+        return NULL;
+    red = cmsReadTag(profile, cmsSigRedColorantTag);
+    green = cmsReadTag(profile, cmsSigGreenColorantTag);
+    blue = cmsReadTag(profile, cmsSigBlueColorantTag);
+    white = cmsReadTag(profile, cmsSigMediaWhitePointTag);
+    if (red == NULL || green == NULL || blue == NULL)
+        return NULL;
+
+    hLinear = cmsCreateProfilePlaceholder(0);
+    cmsSetProfileVersion(hLinear, cmsGetProfileVersion(profile));
+
+    cmsSetDeviceClass(hLinear, cmsSigDisplayClass);
+    cmsSetColorSpace(hLinear, cmsSigRgbData);
+    cmsSetPCS(hLinear, cmsSigXYZData);
+
+    if (white != NULL)
+        cmsWriteTag(hLinear, cmsSigMediaWhitePointTag, white);
+    void *chad = cmsReadTag(profile, cmsSigChromaticAdaptationTag);
+    if (chad != NULL)
+        cmsWriteTag(hLinear, cmsSigChromaticAdaptationTag, chad);
+    cmsWriteTag(hLinear, cmsSigRedColorantTag, red);
+    cmsWriteTag(hLinear, cmsSigGreenColorantTag, green);
+    cmsWriteTag(hLinear, cmsSigBlueColorantTag, blue);
+
+    cmsToneCurve *transferFunction = cmsBuildGamma(NULL, 1.0);
+    cmsWriteTag(hLinear, cmsSigRedTRCTag, (void *)transferFunction);
+    cmsLinkTag(hLinear, cmsSigGreenTRCTag, cmsSigRedTRCTag);
+    cmsLinkTag(hLinear, cmsSigBlueTRCTag, cmsSigRedTRCTag);
+    cmsFreeToneCurve(transferFunction);
+
+    return hLinear;
+}
+
+/*
+ * The profile registry loads, validates and serializes each profile once.
+ * The developers share the lcms profiles and the writers embed the
+ * serialized data, so nothing is read again for the next images.
+ * Profiles of files are kept until the process exits. Profiles given in
+ * memory, such as the display profiles and the linear profiles of float
+ * output, are freed when their last reference is released.
+ */
+typedef struct {
+    uf_profile p; /* must be first, see uf_colorspaces_release_profile() */
+    char *filename; /* NULL for profiles given in memory */
+    int refCount;
+} uf_profile_entry;
+
+static GList *profileRegistry = NULL;
+G_LOCK_DEFINE_STATIC(profile_registry);
+
+#define max_product_name 80
+
+/* Emulates cmsTakeProductName() from lcms 1.x. */
+static char *uf_colorspaces_product_name(cmsHPROFILE profile)
+{
+    char name[max_product_name * 2 + 4];
+    char manufacturer[max_product_name], model[max_product_name];
+
+    name[0] = manufacturer[0] = model[0] = '\0';
+
+    cmsGetProfileInfoASCII(profile, cmsInfoManufacturer,
+                           "en", "US", manufacturer, max_product_name);
+    cmsGetProfileInfoASCII(profile, cmsInfoModel,
+                           "en", "US", model, max_product_name);
+
+    if (!manufacturer[0] && !model[0]) {
+        cmsGetProfileInfoASCII(profile, cmsInfoDescription,
+                               "en", "US", name, max_product_name * 2 + 4);
+    } else {
+        if (!manufacturer[0] || (strncmp(model, manufacturer, 8) == 0) ||
+                strlen(model) > 30)
+            strcpy(name, model);
+        else
+            sprintf(name, "%s - %s", model, manufacturer);
+    }
+
+    return g_strdup(name);
+}
+
+/* Register a valid profile, taking ownership of its data.
+ * Called with the registry lock held. */
+static const uf_profile *uf_colorspaces_register(cmsHPROFILE profile,
+        guint8 *data, guint32 size, const char *filename)
+{
+    uf_profile_entry *entry = g_new(uf_profile_entry, 1);
+    entry->p.profile = profile;
+    entry->p.data = data;
+    entry->p.size = size;
+    if (cmsMD5computeID(profile))
+        cmsGetHeaderProfileID(profile, entry->p.id);
+    else
+        memset(entry->p.id, 0, sizeof entry->p.id);
+    entry->p.productName = uf_colorspaces_product_name(profile);
+    entry->filename = g_strdup(filename);
+    entry->refCount = 0;
+    profileRegistry = g_list_prepend(profileRegistry, entry);
+    return &entry->p;
+}
+
+/* Create the built-in sRGB profile and serialize it for embedding */
+static const uf_profile *uf_colorspaces_register_srgb(void)
+{
+    cmsHPROFILE profile = uf_colorspaces_create_srgb_profile();
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(profile, NULL, &size); // Calculate size.
+    guint8 *data = g_new(guint8, size);
+    if (size == 0 || !cmsSaveProfileToMem(profile, data, &size)) {
+        cmsCloseProfile(profile);
+        g_free(data);
+        return NULL;
+    }
+    return uf_colorspaces_register(profile, data, size, "");
+}
+
+const uf_profile *uf_colorspaces_get_profile(const char *filename)
+{
+    const uf_profile *profile = NULL;
+    GList *l;
+    G_LOCK(profile_registry);
+    for (l = profileRegistry; l != NULL; l = l->next) {
+        uf_profile_entry *entry = l->data;
+        if (entry->filename != NULL && strcmp(entry->filename, filename) == 0) {
+            profile = &entry->p;
+            break;
+        }
+    }
+    if (profile == NULL && filename[0] == '\0') {
+        profile = uf_colorspaces_register_srgb();
+    } else if (profile == NULL) {
+        gchar *data;
+        gsize size;
+        if (g_file_get_contents(filename, &data, &size, NULL)) {
+            cmsHPROFILE hProfile = cmsOpenProfileFromMem(data, size);
+            if (hProfile != NULL)
+                profile = uf_colorspaces_register(hProfile, (guint8 *)data,
+                                                  size, filename);
+            else
+                g_free(data);
+        }
+    }
+    if (profile != NULL)
+        ((uf_profile_entry *)profile)->refCount++;
+    G_UNLOCK(profile_registry);
+    return profile;
+}
+
+const uf_profile *uf_colorspaces_get_profile_from_mem(const guint8 *data,
+        guint32 size)
+{
+    const uf_profile *profile = NULL;
+    GList *l;
+    G_LOCK(profile_registry);
+    for (l = profileRegistry; l != NULL; l = l->next) {
+        uf_profile_entry *entry = l->data;
+        if (entry->filename == NULL && entry->p.size == size &&
+                memcmp(entry->p.data, data, size) == 0) {
+            profile = &entry->p;
+            break;
+        }
+    }
+    if (profile == NULL) {
+        cmsHPROFILE hProfile = cmsOpenProfileFromMem(data, size);
+        if (hProfile != NULL) {
+            guint8 *copy = g_new(guint8, size);
+            memcpy(copy, data, size);
+            profile = uf_colorspaces_register(hProfile, copy, size, NULL);
+        }
+    }
+    if (profile != NULL)
+        ((uf_profile_entry *)profile)->refCount++;
+    G_UNLOCK(profile_registry);
+    return profile;
+}
+
+const uf_profile *uf_colorspaces_get_linear_profile(cmsHPROFILE profile)
+{
+    cmsHPROFILE hLinear = uf_colorspaces_create_linear_profile(profile);
+    if (hLinear == NULL)
+        return NULL;
+    cmsUInt32Number size = 0;
+    cmsSaveProfileToMem(hLinear, NULL, &size); // Calculate size.
+    guint8 *data = g_new(guint8, size);
+    const uf_profile *linear = NULL;
+    if (size > 0 && cmsSaveProfileToMem(hLinear, data, &size))
+        linear = uf_colorspaces_get_profile_from_mem(data, size);
+    cmsCloseProfile(hLinear);
+    g_free(data);
+    return linear;
+}
+
+void uf_colorspaces_release_profile(const uf_profile *profile)
+{
+    if (profile == NULL)
+        return;
+    uf_profile_entry *entry = (uf_profile_entry *)profile;
+    G_LOCK(profile_registry);
+    if (--entry->refCount == 0 && entry->filename == NULL) {
+        profileRegistry = g_list_remove(profileRegistry, entry);
+        cmsCloseProfile(entry->p.profile);
+        g_free((guint8 *)entry->p.data);
+        g_free(entry->p.productName);
+        g_free(entry);
+    }
+    G_UNLOCK(profile_registry);
+}
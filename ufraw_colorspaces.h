@@ -1,7 +1,8 @@
 /*
  * UFRaw - Unidentified Flying Raw converter for digital camera images
  *
- * ufraw_colorspaces.h - Built-in color profile declarations.
+ * ufraw_colorspaces.h - Built-in color profile and profile registry
+ * declarations.
  * Copyright 2004-2016 by Udi Fuchs
  *
  * This program is free software; you can redistribute it and/or modify
@@ -12,3 +13,36 @@
 
 /** create the ICC virtual profile for srgb space. */
 cmsHPROFILE uf_colorspaces_create_srgb_profile(void);
+
+/** create a copy of a matrix-shaper RGB profile with linear tone curves.
+ * NULL is returned for other profiles. */
+cmsHPROFILE uf_colorspaces_create_linear_profile(cmsHPROFILE profile);
+
+/** An ICC profile shared by the whole process. The functions returning a
+ * profile take a reference to it, which is dropped by
+ * uf_colorspaces_release_profile(). */
+typedef struct _uf_profile {
+    /** The lcms profile, which must not be closed. */
+    cmsHPROFILE profile;
+    /** The profile to embed in output images. */
+    const guint8 *data;
+    guint32 size;
+    /** The MD5 ID of the profile, which identifies its contents. */
+    guint8 id[16];
+    char *productName;
+} uf_profile;
+
+/** get the profile of an ICC file, or of the built-in sRGB for "".
+ * NULL is returned if the file can not be read or is not a valid profile. */
+const uf_profile *uf_colorspaces_get_profile(const char *filename);
+
+/** get the profile serialized in data, NULL if it is not a valid profile. */
+const uf_profile *uf_colorspaces_get_profile_from_mem(const guint8 *data,
+        guint32 size);
+
+/** get the linear copy of a matrix-shaper RGB profile, to be embedded in
+ * float output. NULL is returned for other profiles. */
+const uf_profile *uf_colorspaces_get_linear_profile(cmsHPROFILE profile);
+
+/** drop a reference to a profile, which may be NULL. */
+void uf_colorspaces_release_profile(const uf_profile *profile);
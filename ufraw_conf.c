@@ -117,6 +117,7 @@ const conf_data conf_default = {
     FALSE, /* load embedded preview image */
     FALSE, /* noExit */
     TRUE, /* rotate to camera's setting */
+    0, /* colorLut */
 
     /* GUI settings */
     25.0, TRUE, /* Zoom, LockAspect */
@@ -133,6 +134,9 @@ const conf_data conf_default = {
     0, /* number of helper lines to draw */
     "", "", /* curvePath, profilePath */
     FALSE, /* silent */
+    1, /* jobs */
+    no_timings, /* timings */
+    "", /* traceFilename */
 #ifdef _WIN32
     "gimp-win-remote gimp-2.8.exe", /* remoteGimpCommand */
 #elif HAVE_GIMP_2_4
@@ -673,6 +677,11 @@ static void conf_parse_text(GMarkupParseContext *context, const gchar *text,
     if (!strcmp("ClipHighlights", element))
         c->clipHighlights = conf_find_name(temp, clipHighlightsNames,
                                            conf_default.clipHighlights);
+    if (!strcmp("ColorLut", element)) {
+        sscanf(temp, "%d", &c->colorLut);
+        if (c->colorLut < 0 || c->colorLut == 1 || c->colorLut > 256)
+            c->colorLut = conf_default.colorLut;
+    }
     /* For compatibility with UFRaw-0.10 and earlier. */
     if (!strcmp("Unclip", element)) {
         int unclip;
@@ -1048,6 +1057,8 @@ int conf_save(conf_data *c, char *IDFilename, char **confBuffer)
     if (c->clipHighlights != conf_default.clipHighlights)
         buf = uf_markup_buf(buf, "<ClipHighlights>%s</ClipHighlights>\n",
                             conf_get_name(clipHighlightsNames, c->clipHighlights));
+    if (c->colorLut != conf_default.colorLut)
+        buf = uf_markup_buf(buf, "<ColorLut>%d</ColorLut>\n", c->colorLut);
     if (c->autoExposure != conf_default.autoExposure)
         buf = uf_markup_buf(buf,
                             "<AutoExposure>%d</AutoExposure>\n", c->autoExposure);
@@ -1440,6 +1451,7 @@ void conf_copy_image(conf_data *dst, const conf_data *src)
     }
     dst->intent[out_profile] = src->intent[out_profile];
     dst->intent[display_profile] = src->intent[display_profile];
+    dst->colorLut = src->colorLut;
 }
 
 /* Copy the transformation information from *src to *dst. */
@@ -1501,6 +1513,7 @@ int conf_set_cmd(conf_data *conf, const conf_data *cmd)
     if (cmd->embeddedImage != -1) conf->embeddedImage = cmd->embeddedImage;
     if (cmd->noExit != -1) conf->noExit = cmd->noExit;
     if (cmd->rotate != -1) conf->rotate = cmd->rotate;
+    if (cmd->colorLut != -1) conf->colorLut = cmd->colorLut;
     if (cmd->rotationAngle != NULLF) conf->rotationAngle = cmd->rotationAngle;
     if (cmd->autoCrop != -1)
         if ((conf->autoCrop = cmd->autoCrop) == enabled_state)
@@ -1579,6 +1592,16 @@ int conf_set_cmd(conf_data *conf, const conf_data *cmd)
             conf->interpolation = ahd_interpolation;
     }
     if (cmd->type >= 0) conf->type = cmd->type;
+    /* The output type may come from the ID file or the resources, which
+     * --out-type checks could not see. */
+    profile_data *out = &conf->profile[1][conf->profileIndex[1]];
+    if (out->BitDepth == 32 && conf->type != tiff_type &&
+            conf->type != fits_type) {
+        ufraw_message(UFRAW_WARNING,
+                      _("32 bit depth is only supported for TIFF and "
+                        "FITS output, using 16 bit."));
+        out->BitDepth = 16;
+    }
     if (cmd->createID >= 0) conf->createID = cmd->createID;
     if (strlen(cmd->darkframeFile) > 0)
         g_strlcpy(conf->darkframeFile, cmd->darkframeFile, max_path);
@@ -1653,6 +1676,9 @@ char *helpText[] = {
     N_("--contrast=CONT       Contrast adjustment (default 1.0).\n"),
 #endif
     N_("--saturation=SAT      Saturation adjustment (default 1.0, 0 for B&W output).\n"),
+    N_("--color-lut=N         Apply the color profiles through an NxNxN lookup table\n"
+    "                      built once for each conversion, for example 65\n"
+    "                      (default 0, apply the profiles to each pixel).\n"),
     N_("--wavelet-denoising-threshold=THRESHOLD\n"
     "                      Wavelet denoising threshold (default 0.0).\n"),
     N_("--hotpixel-sensitivity=VALUE\n"
@@ -1675,7 +1701,8 @@ char *helpText[] = {
     N_("--size=SIZE           Downsize max(height,width) to SIZE.\n"),
     N_("--out-type=ppm|tiff|tif|png|jpeg|jpg|fits\n"
     "                      Output file format (default ppm).\n"),
-    N_("--out-depth=8|16      Output bit depth per channel (default 8).\n"),
+    N_("--out-depth=8|16|32   Output bit depth per channel (default 8).\n"
+    "                      32 writes linear floats, only for TIFF and FITS.\n"),
     N_("--create-id=no|also|only\n"
     "                      Create no|also|only ID file (default no).\n"),
     N_("--compression=VALUE   JPEG compression (0-100, default 85).\n"),
@@ -1703,6 +1730,14 @@ char *helpText[] = {
     N_("--maximize-window     Force window to be maximized.\n"),
     N_("--silent              Do not display any messages during conversion. This\n"
     "                      option is only valid with 'ufraw-batch'.\n"),
+    N_("--jobs=N              Convert N files at the same time (default 1). This\n"
+    "                      option is only valid with 'ufraw-batch'.\n"),
+    N_("--timings=table|json  Report the time and memory used by each stage of the\n"
+    "                      conversion. This option is only valid with\n"
+    "                      'ufraw-batch'.\n"),
+    N_("--trace=FILE          Write a trace of the conversion stages and of the work\n"
+    "                      of each thread to FILE, in the Chrome trace event\n"
+    "                      format. This option is only valid with 'ufraw-batch'.\n"),
     "\n",
     N_("UFRaw first reads the setting from the resource file $HOME/.ufrawrc.\n"
     "Then, if an ID file is specified, its setting are read. Next, the setting from\n"
@@ -1798,7 +1833,8 @@ int ufraw_process_args(int *argc, char ***argv, conf_data *cmd, conf_data *rc)
            *createIDName = NULL, *outPath = NULL, *output = NULL, *conf = NULL,
             *interpolationName = NULL, *darkframeFile = NULL,
              *restoreName = NULL, *clipName = NULL, *grayscaleName = NULL,
-              *grayscaleMixer = NULL;
+              *grayscaleMixer = NULL, *timingsName = NULL,
+               *traceName = NULL;
     static const struct option options[] = {
         { "wb", 1, 0, 'w'},
         { "temperature", 1, 0, 't'},
@@ -1841,6 +1877,10 @@ int ufraw_process_args(int *argc, char ***argv, conf_data *cmd, conf_data *rc)
         { "crop-right", 1, 0, '3'},
         { "crop-bottom", 1, 0, '4'},
         { "aspect-ratio", 1, 0, 'P'},
+        { "jobs", 1, 0, 'J'},
+        { "timings", 1, 0, 'K'},
+        { "trace", 1, 0, 'N'},
+        { "color-lut", 1, 0, 'U'},
         /* Binary flags that don't have a value are here at the end */
         { "zip", 0, 0, 'z'},
         { "nozip", 0, 0, 'Z'},
@@ -1880,7 +1920,8 @@ int ufraw_process_args(int *argc, char ***argv, conf_data *cmd, conf_data *rc)
         &createIDName, &outPath, &output, &darkframeFile,
         &restoreName, &clipName, &conf,
         &cmd->CropX1, &cmd->CropY1, &cmd->CropX2, &cmd->CropY2,
-        &cmd->aspectRatio
+        &cmd->aspectRatio, &cmd->jobs, &timingsName, &traceName,
+        &cmd->colorLut
     };
     cmd->autoExposure = disabled_state;
     cmd->autoBlack = disabled_state;
@@ -1892,6 +1933,8 @@ int ufraw_process_args(int *argc, char ***argv, conf_data *cmd, conf_data *rc)
     cmd->profile[1][0].BitDepth = -1;
     cmd->embeddedImage = FALSE;
     cmd->silent = FALSE;
+    cmd->jobs = -1;
+    cmd->colorLut = -1;
     cmd->profile[0][0].gamma = NULLF;
     cmd->profile[0][0].linear = NULLF;
     cmd->hotpixel = NULLF;
@@ -1974,6 +2017,8 @@ int ufraw_process_args(int *argc, char ***argv, conf_data *cmd, conf_data *rc)
             case '2':
             case '3':
             case '4':
+            case 'J':
+            case 'U':
                 locale = uf_set_locale_C();
                 if (sscanf(optarg, "%d", (int *)optPointer[index]) == 0) {
                     ufraw_message(UFRAW_ERROR,
@@ -2000,6 +2045,8 @@ int ufraw_process_args(int *argc, char ***argv, conf_data *cmd, conf_data *rc)
             case 'u':
             case 'Y':
             case 'a':
+            case 'K':
+            case 'N':
                 *(char **)optPointer[index] = optarg;
                 break;
             case 'O':
@@ -2235,9 +2282,22 @@ int ufraw_process_args(int *argc, char ***argv, conf_data *cmd, conf_data *rc)
                       _("you can not specify both --shrink and --size"));
         return -1;
     }
+    if (cmd->jobs != -1 && cmd->jobs < 1) {
+        ufraw_message(UFRAW_ERROR,
+                      _("'%d' is not a valid number of jobs."), cmd->jobs);
+        return -1;
+    }
+    if (cmd->colorLut != -1 &&
+            (cmd->colorLut < 0 || cmd->colorLut == 1 || cmd->colorLut > 256)) {
+        ufraw_message(UFRAW_ERROR,
+                      _("'%d' is not a valid color lookup table size."),
+                      cmd->colorLut);
+        return -1;
+    }
     if (cmd->profile[1][0].BitDepth != -1) {
         if (cmd->profile[1][0].BitDepth != 8 &&
-                cmd->profile[1][0].BitDepth != 16) {
+                cmd->profile[1][0].BitDepth != 16 &&
+                cmd->profile[1][0].BitDepth != 32) {
             ufraw_message(UFRAW_ERROR,
                           _("'%d' is not a valid bit depth."),
                           cmd->profile[1][0].BitDepth);
@@ -2364,6 +2424,13 @@ int ufraw_process_args(int *argc, char ***argv, conf_data *cmd, conf_data *rc)
                           _("'%s' is not a valid output type."), outTypeName);
             return -1;
         }
+        if (cmd->profile[1][0].BitDepth == 32 &&
+                cmd->type != tiff_type && cmd->type != fits_type) {
+            ufraw_message(UFRAW_ERROR,
+                          _("32 bit depth is only supported for TIFF and "
+                            "FITS output."));
+            return -1;
+        }
     }
     if (cmd->embeddedImage) {
 #ifndef HAVE_LIBJPEG
@@ -2419,6 +2486,24 @@ int ufraw_process_args(int *argc, char ***argv, conf_data *cmd, conf_data *rc)
             return -1;
         }
     }
+    cmd->timings = -1;
+    if (timingsName != NULL) {
+        if (!strcmp(timingsName, "table"))
+            cmd->timings = table_timings;
+        else if (!strcmp(timingsName, "json"))
+            cmd->timings = json_timings;
+        else {
+            ufraw_message(UFRAW_ERROR,
+                          _("'%s' is not a valid timings format."), timingsName);
+            return -1;
+        }
+    }
+    g_strlcpy(cmd->traceFilename, "", max_path);
+    if (traceName != NULL) {
+        traceName = uf_win32_locale_to_utf8(traceName);
+        g_strlcpy(cmd->traceFilename, traceName, max_path);
+        uf_win32_locale_free(traceName);
+    }
     g_strlcpy(cmd->outputPath, "", max_path);
     if (outPath != NULL) {
         outPath = uf_win32_locale_to_utf8(outPath);
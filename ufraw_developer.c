@@ -11,6 +11,7 @@
  */
 
 #include "ufraw.h"
+#include <glib/gi18n.h>
 #ifdef _OPENMP
 #include <omp.h>
 #endif
@@ -18,7 +19,11 @@
 #include <string.h>
 #include <lcms2.h>
 #include <lcms2_plugin.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "ufraw_colorspaces.h"
+#include "ufraw_cielab.h"
 
 static void lcms_message(cmsContext ContextID,
                          cmsUInt32Number ErrorCode,
@@ -37,12 +42,15 @@ developer_data *developer_init()
     d->mode = -1;
     d->gamma = -1;
     d->linear = -1;
+    d->exposure = 0;
+    d->clipHighlights = -1;
     d->saturation = -1;
 #ifdef UFRAW_CONTRAST
     d->contrast = -1;
 #endif
     for (i = 0; i < profile_types; i++) {
         d->profile[i] = NULL;
+        d->registeredProfile[i] = NULL;
         strcpy(d->profileFile[i], "no such file");
     }
     memset(&d->baseCurveData, 0, sizeof(d->baseCurveData));
@@ -59,8 +67,15 @@ developer_data *developer_init()
     d->intent[display_profile] = -1;
     d->updateTransform = TRUE;
     d->colorTransform = NULL;
+    d->colorLutSize = 0;
+    d->colorLut = NULL;
+    d->colorShaper = NULL;
     d->working2displayTransform = NULL;
     d->rgbtolabTransform = NULL;
+    d->floatOutput = FALSE;
+    d->floatTransform = NULL;
+    d->linearLut = NULL;
+    d->linearLutGamma = FALSE;
     d->grayscaleMode = -1;
     d->grayscaleMixer[0] = d->grayscaleMixer[1] = d->grayscaleMixer[2] = -1;
     for (i = 0; i < max_adjustments; i++) { /* Suppress valgrind error. */
@@ -72,58 +87,51 @@ developer_data *developer_init()
     return d;
 }
 
+static void transform_cache_release(cmsHTRANSFORM transform);
+
 void developer_destroy(developer_data *d)
 {
     int i;
     if (d == NULL) return;
     for (i = 0; i < profile_types; i++)
-        if (d->profile[i] != NULL) cmsCloseProfile(d->profile[i]);
+        uf_colorspaces_release_profile(d->registeredProfile[i]);
     cmsCloseProfile(d->luminosityProfile);
     cmsFreeToneCurve(d->TransferFunction[0]);
     cmsFreeToneCurve(d->TransferFunction[1]);
     cmsCloseProfile(d->saturationProfile);
     cmsCloseProfile(d->adjustmentProfile);
-    if (d->colorTransform != NULL)
-        cmsDeleteTransform(d->colorTransform);
-    if (d->working2displayTransform != NULL)
-        cmsDeleteTransform(d->working2displayTransform);
-    if (d->rgbtolabTransform != NULL)
-        cmsDeleteTransform(d->rgbtolabTransform);
+    transform_cache_release(d->colorTransform);
+    transform_cache_release(d->working2displayTransform);
+    transform_cache_release(d->rgbtolabTransform);
+    transform_cache_release(d->floatTransform);
+    g_free(d->linearLut);
     g_free(d);
 }
 
 static const char *embedded_display_profile = "embedded display profile";
 
-/*
- * Emulates cmsTakeProductName() from lcms 1.x.
- *
- * This is tailored for use with statically allocated strings and not
- * thread-safe.
- */
-const char *cmsTakeProductName(cmsHPROFILE profile)
+/* Set the profile of the given type from the registry, taking over the
+ * reference to it. If the profile could not be loaded fall-back to sRGB. */
+static void developer_set_profile(developer_data *d, int type,
+                                  const uf_profile *profile)
 {
-    static char name[max_name * 2 + 4];
-    char manufacturer[max_name], model[max_name];
-
-    name[0] = manufacturer[0] = model[0] = '\0';
-
-    cmsGetProfileInfoASCII(profile, cmsInfoManufacturer,
-                           "en", "US", manufacturer, max_name);
-    cmsGetProfileInfoASCII(profile, cmsInfoModel,
-                           "en", "US", model, max_name);
-
-    if (!manufacturer[0] && !model[0]) {
-        cmsGetProfileInfoASCII(profile, cmsInfoDescription,
-                               "en", "US", name, max_name * 2 + 4);
-    } else {
-        if (!manufacturer[0] || (strncmp(model, manufacturer, 8) == 0) ||
-                strlen(model) > 30)
-            strcpy(name, model);
-        else
-            sprintf(name, "%s - %s", model, manufacturer);
-    }
+    if (profile == NULL)
+        profile = uf_colorspaces_get_profile("");
+    if (profile != d->registeredProfile[type])
+        d->updateTransform = TRUE;
+    uf_colorspaces_release_profile(d->registeredProfile[type]);
+    d->registeredProfile[type] = profile;
+    d->profile[type] = profile != NULL ? profile->profile : NULL;
+}
 
-    return name;
+static void developer_product_name(developer_data *d, int type,
+                                   char productName[])
+{
+    if (d->registeredProfile[type] != NULL)
+        g_strlcpy(productName, d->registeredProfile[type]->productName,
+                  max_name);
+    else
+        strcpy(productName, "");
 }
 
 /* Update the profile in the developer
@@ -135,26 +143,12 @@ void developer_profile(developer_data *d, int type, profile_data *p)
         return;
     if (strcmp(p->file, d->profileFile[type])) {
         g_strlcpy(d->profileFile[type], p->file, max_path);
-        if (d->profile[type] != NULL) cmsCloseProfile(d->profile[type]);
-        if (!strcmp(d->profileFile[type], ""))
-            d->profile[type] = uf_colorspaces_create_srgb_profile();
-        else {
-            char *filename =
-                uf_win32_locale_filename_from_utf8(d->profileFile[type]);
-            d->profile[type] = cmsOpenProfileFromFile(filename, "r");
-            uf_win32_locale_filename_free(filename);
-            if (d->profile[type] == NULL)
-                d->profile[type] = uf_colorspaces_create_srgb_profile();
-        }
+        developer_set_profile(d, type,
+                              uf_colorspaces_get_profile(d->profileFile[type]));
         d->updateTransform = TRUE;
     }
-    if (d->updateTransform) {
-        if (d->profile[type] != NULL)
-            g_strlcpy(p->productName, cmsTakeProductName(d->profile[type]),
-                      max_name);
-        else
-            strcpy(p->productName, "");
-    }
+    if (d->updateTransform)
+        developer_product_name(d, type, p->productName);
 }
 
 void developer_display_profile(developer_data *d,
@@ -162,11 +156,9 @@ void developer_display_profile(developer_data *d,
 {
     int type = display_profile;
     if (profile != NULL) {
-        if (d->profile[type] != NULL) cmsCloseProfile(d->profile[type]);
-        d->profile[type] = cmsOpenProfileFromMem(profile, size);
         // If embedded profile is invalid fall-back to sRGB
-        if (d->profile[type] == NULL)
-            d->profile[type] = uf_colorspaces_create_srgb_profile();
+        developer_set_profile(d, type,
+                              uf_colorspaces_get_profile_from_mem(profile, size));
         if (strcmp(d->profileFile[type], embedded_display_profile) != 0) {
             // start using embedded profile
             g_strlcpy(d->profileFile[type], embedded_display_profile, max_path);
@@ -175,19 +167,13 @@ void developer_display_profile(developer_data *d,
     } else {
         if (strcmp(d->profileFile[type], embedded_display_profile) == 0) {
             // embedded profile is no longer used
-            if (d->profile[type] != NULL) cmsCloseProfile(d->profile[type]);
-            d->profile[type] = uf_colorspaces_create_srgb_profile();
+            developer_set_profile(d, type, uf_colorspaces_get_profile(""));
             strcpy(d->profileFile[type], "");
             d->updateTransform = TRUE;
         }
     }
-    if (d->updateTransform) {
-        if (d->profile[type] != NULL)
-            g_strlcpy(productName, cmsTakeProductName(d->profile[type]),
-                      max_name);
-        else
-            strcpy(productName, "");
-    }
+    if (d->updateTransform)
+        developer_product_name(d, type, productName);
 }
 
 static double clamp(double in, double min, double max)
@@ -394,8 +380,471 @@ static double findExpCoeff(double b)
     return a;
 }
 
+/* FilmCurve[] maps the raw values to the exposed values. Exposure of
+ * digital highlights is applied in develop_linear(), so the curve is the
+ * identity for them. */
+static void developer_film_curve(guint16 filmCurve[0x10000],
+                                 int clipHighlights, unsigned exposure)
+{
+    int i;
+
+    if (clipHighlights == film_highlights) {
+        /* Exposure is set by FilmCurve[].
+         * Set initial slope to exposure/0x10000 */
+        double a = findExpCoeff((double)exposure / 0x10000);
+        double norm = 1 - exp(-a);
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static) default(shared) private(i)
+#endif
+        for (i = 0; i < 0x10000; i++)
+            filmCurve[i] = (1 - exp(-a * i / 0x10000)) / norm * 0xFFFF;
+    } else { /* digital highlights */
+        for (i = 0; i < 0x10000; i++) filmCurve[i] = i;
+    }
+}
+
+/* The gamma table is the linearized gamma curve of the input profile,
+ * applied to the output of the base curve. */
+static void developer_gamma_table(guint16 gammaTable[0x10000],
+                                  double gamma, double linear)
+{
+    double a, b, c, g;
+    int i;
+
+    /* The parameters of the linearized gamma curve are set in a way that
+     * keeps the curve continuous and smooth at the connecting point.
+     * linear also changes the real gamma used for the curve (g) in
+     * a way that keeps the derivative at i=0x10000 constant.
+     * This way changing the linearity changes the curve behaviour in
+     * the shadows, but has a minimal effect on the rest of the range. */
+    if (linear < 1.0) {
+        g = gamma * (1.0 - linear) / (1.0 - gamma * linear);
+        a = 1.0 / (1.0 + linear * (g - 1));
+        b = linear * (g - 1) * a;
+        c = pow(a * linear + b, g) / linear;
+    } else {
+        a = b = g = 0.0;
+        c = 1.0;
+    }
+    /* The linear segment needs no pow(). The rest is split between the
+     * threads, since pow() is by far the most expensive part. */
+    int knee = MIN(ceil(0x10000 * linear), 0x10000);
+    for (i = 0; i < knee; i++)
+        gammaTable[i] = MIN(c * i, 0xFFFF);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) default(shared) private(i)
+#endif
+    for (i = knee; i < 0x10000; i++)
+        gammaTable[i] = MIN(pow(a * i / 0x10000 + b, g) * 0x10000, 0xFFFF);
+}
+
+/* For the file developer, the white balance, clipping and exposure
+ * scaling of develop_linear() are precomputed for every 16-bit value of
+ * each channel. Pixels that need their highlights restored are still
+ * developed by develop_linear(), clipLimit[c] is the first value of each
+ * channel for which this happens. The gamma curve can be applied in the
+ * same pass only without the color matrix and grayscale mixing, since
+ * both of them combine the channels before the curve. */
+static void developer_linear_lut(developer_data *d, DeveloperMode mode)
+{
+    unsigned c;
+    int i;
+
+    if (mode != file_developer) {
+        g_free(d->linearLut);
+        d->linearLut = NULL;
+        d->linearLutGamma = FALSE;
+        return;
+    }
+    if (d->linearLut == NULL)
+        d->linearLut = g_new(gint32, 4 * 0x10000);
+    for (c = 0; c < d->colors; c++) {
+        gint32 *lut = d->linearLut + c * 0x10000;
+        d->clipLimit[c] = 0x10000;
+        for (i = 0; i < 0x10000; i++) {
+            gint64 v = (gint64)i * d->rgbWB[c] / 0x10000;
+            if (d->restoreDetails != clip_details && v > d->max &&
+                    d->clipLimit[c] == 0x10000)
+                d->clipLimit[c] = i;
+            v = MIN(v, d->max);
+            if (d->clipHighlights == film_highlights)
+                v = v * 0x10000 / d->max;
+            else
+                v = v * d->exposure / d->max;
+            /* Above +15 EV the highest values do not fit in gint32. They
+             * are far beyond the white point anyway. */
+            lut[i] = MIN(v, G_MAXINT32);
+        }
+    }
+    d->linearLutGamma = !d->useMatrix && d->grayscaleMode == grayscale_none;
+}
+
+/*
+ * A transformation between two RGB matrix-shaper profiles, which is done
+ * with the input curves, a 3x3 matrix and the output curves instead of
+ * going through lcms. The output curves are sampled on the square root of
+ * the linear values, which keeps them accurate in the shadows, where the
+ * curves are steep.
+ */
+typedef struct {
+    float linear[3][0x10000];
+    float matrix[3][3];
+    guint16 shaper[3][0x10000];
+} matrix_shaper;
+
+/* The largest difference from lcms accepted for a matrix shaper,
+ * in 16-bit units. */
+static const int max_shaper_error = 32;
+
+/* Read the colorants and curves of an RGB matrix-shaper profile.
+ * Profiles which lcms would use through a LUT are rejected. */
+static gboolean matrix_shaper_tags(cmsHPROFILE profile, int intent,
+                                   int direction, double colorants[3][3],
+                                   cmsToneCurve *curves[3])
+{
+    static const cmsTagSignature colorantTags[3] = {
+        cmsSigRedColorantTag, cmsSigGreenColorantTag, cmsSigBlueColorantTag
+    };
+    static const cmsTagSignature curveTags[3] = {
+        cmsSigRedTRCTag, cmsSigGreenTRCTag, cmsSigBlueTRCTag
+    };
+    int c;
+
+    if (cmsGetColorSpace(profile) != cmsSigRgbData ||
+            !cmsIsMatrixShaper(profile) ||
+            cmsIsCLUT(profile, intent, direction))
+        return FALSE;
+    for (c = 0; c < 3; c++) {
+        cmsCIEXYZ *xyz = cmsReadTag(profile, colorantTags[c]);
+        curves[c] = cmsReadTag(profile, curveTags[c]);
+        if (xyz == NULL || curves[c] == NULL)
+            return FALSE;
+        colorants[0][c] = xyz->X;
+        colorants[1][c] = xyz->Y;
+        colorants[2][c] = xyz->Z;
+    }
+    return TRUE;
+}
+
+static gboolean matrix_invert(const double m[3][3], double inv[3][3])
+{
+    double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) -
+                 m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) +
+                 m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    int i, j;
+
+    if (fabs(det) < 1e-9)
+        return FALSE;
+    for (i = 0; i < 3; i++)
+        for (j = 0; j < 3; j++)
+            inv[i][j] = (m[(j + 1) % 3][(i + 1) % 3] * m[(j + 2) % 3][(i + 2) % 3] -
+                         m[(j + 1) % 3][(i + 2) % 3] * m[(j + 2) % 3][(i + 1) % 3]) / det;
+    return TRUE;
+}
+
+static void develop_matrix_shaper(const matrix_shaper *shaper, guint16 *pix,
+                                  int count);
+
+/* Sample the matrix shaper and the unoptimized lcms transformation on a
+ * grid, to make sure that they agree. */
+static gboolean matrix_shaper_verify(const matrix_shaper *shaper,
+                                     cmsHPROFILE in, cmsHPROFILE out,
+                                     int intent)
+{
+    const int size = 17, n = size * size * size;
+    cmsHTRANSFORM exact = cmsCreateTransform(in, TYPE_RGB_DBL, out,
+                          TYPE_RGB_DBL, intent, cmsFLAGS_NOOPTIMIZE);
+    if (exact == NULL)
+        return FALSE;
+    guint16 *pix = g_new(guint16, 3 * n);
+    double *ref = g_new(double, 3 * n);
+    int i, c, error = 0;
+    for (i = 0; i < n; i++) {
+        pix[3 * i] = i / (size * size) * 0xFFFF / (size - 1);
+        pix[3 * i + 1] = i / size % size * 0xFFFF / (size - 1);
+        pix[3 * i + 2] = i % size * 0xFFFF / (size - 1);
+        for (c = 0; c < 3; c++)
+            ref[3 * i + c] = pix[3 * i + c] / 65535.0;
+    }
+    cmsDoTransform(exact, ref, ref, n);
+    cmsDeleteTransform(exact);
+    develop_matrix_shaper(shaper, pix, n);
+    for (i = 0; i < 3 * n; i++) {
+        int v = floor(LIM(ref[i], 0, 1) * 0xFFFF + 0.5);
+        error = MAX(error, abs(pix[i] - v));
+    }
+    g_free(ref);
+    g_free(pix);
+    return error <= max_shaper_error;
+}
+
+/* Return the matrix shaper transformation from in to out, or NULL if
+ * the profiles are not both RGB matrix-shapers. */
+static matrix_shaper *developer_matrix_shaper(cmsHPROFILE in,
+        cmsHPROFILE out, int intent)
+{
+    double inColorants[3][3], outColorants[3][3], outInverse[3][3];
+    cmsToneCurve *inCurves[3], *outCurves[3];
+    int i, c, cc;
+
+    /* The absolute colorimetric intent also scales the white point */
+    if (intent == INTENT_ABSOLUTE_COLORIMETRIC ||
+            !matrix_shaper_tags(in, intent, LCMS_USED_AS_INPUT,
+                                inColorants, inCurves) ||
+            !matrix_shaper_tags(out, intent, LCMS_USED_AS_OUTPUT,
+                                outColorants, outCurves) ||
+            !matrix_invert(outColorants, outInverse))
+        return NULL;
+
+    matrix_shaper *shaper = g_new(matrix_shaper, 1);
+    for (cc = 0; cc < 3; cc++)
+        for (c = 0; c < 3; c++)
+            shaper->matrix[cc][c] = outInverse[cc][0] * inColorants[0][c] +
+                                    outInverse[cc][1] * inColorants[1][c] +
+                                    outInverse[cc][2] * inColorants[2][c];
+    for (c = 0; c < 3; c++) {
+        cmsToneCurve *reverse = cmsReverseToneCurve(outCurves[c]);
+        if (reverse == NULL) {
+            g_free(shaper);
+            return NULL;
+        }
+        for (i = 0; i < 0x10000; i++) {
+            double x = i / 65535.0;
+            shaper->linear[c][i] = cmsEvalToneCurveFloat(inCurves[c], x);
+            shaper->shaper[c][i] = floor(LIM(cmsEvalToneCurveFloat(reverse,
+                                             x * x), 0, 1) * 0xFFFF + 0.5);
+        }
+        cmsFreeToneCurve(reverse);
+    }
+    if (!matrix_shaper_verify(shaper, in, out, intent)) {
+        g_free(shaper);
+        return NULL;
+    }
+    return shaper;
+}
+
+/* Sample the color transformation on a size^3 grid of RGB values */
+static guint16 *developer_color_lut(cmsHTRANSFORM transform, int size)
+{
+    int n = size * size * size;
+    guint16 *lut = g_new(guint16, 3 * n);
+    guint16 *p = lut;
+    int r, g, b;
+    for (r = 0; r < size; r++)
+        for (g = 0; g < size; g++)
+            for (b = 0; b < size; b++, p += 3) {
+                p[0] = r * 0xFFFF / (size - 1);
+                p[1] = g * 0xFFFF / (size - 1);
+                p[2] = b * 0xFFFF / (size - 1);
+            }
+    cmsDoTransform(transform, lut, lut, n);
+    return lut;
+}
+
+/*
+ * The transformations are kept in a process wide cache, so that developers
+ * with the same settings share them instead of creating them again for
+ * every image. A transformation is identified by the contents of its
+ * profiles, the intent and the parameters of the abstract profiles between
+ * them. lcms transformations can be used by several threads at once.
+ *
+ * The cache holds a reference count for each transformation. Up to
+ * max_unused_transforms transformations which are no longer used by any
+ * developer are kept for the next images.
+ */
+typedef enum {
+    color_transform, display_transform, lab_transform, float_transform
+} TransformType;
+
+typedef struct {
+    TransformType type;
+    guint8 profileID[2][16];
+    int intent;
+    int colorLutSize;
+    gboolean luminosity, adjustment, saturation;
+    CurveData luminosityCurve;
+    lightness_adjustment lightnessAdjustment[max_adjustments];
+    double saturationValue, contrast;
+} transform_key;
+
+typedef struct {
+    transform_key key;
+    gboolean shared;
+    int refCount;
+    cmsHTRANSFORM transform;
+    guint16 *lut;
+    matrix_shaper *shaper;
+} transform_entry;
+
+static const int max_unused_transforms = 8;
+/* Most recently used entries first */
+static GList *transformCache = NULL;
+G_LOCK_DEFINE_STATIC(transform_cache);
+
+static void transform_entry_free(transform_entry *entry)
+{
+    cmsDeleteTransform(entry->transform);
+    g_free(entry->lut);
+    g_free(entry->shaper);
+    g_free(entry);
+}
+
+/* Return the cached transformation for key with a new reference,
+ * or NULL if there is none. */
+static transform_entry *transform_cache_lookup(const transform_key *key)
+{
+    GList *l;
+    G_LOCK(transform_cache);
+    for (l = transformCache; l != NULL; l = l->next) {
+        transform_entry *entry = l->data;
+        if (entry->shared && memcmp(&entry->key, key, sizeof *key) == 0) {
+            entry->refCount++;
+            transformCache = g_list_remove_link(transformCache, l);
+            transformCache = g_list_concat(l, transformCache);
+            G_UNLOCK(transform_cache);
+            return entry;
+        }
+    }
+    G_UNLOCK(transform_cache);
+    return NULL;
+}
+
+/* Add a new transformation to the cache with one reference.
+ * Transformations of profiles that have no ID are never shared. */
+static transform_entry *transform_cache_insert(const transform_key *key,
+        cmsHTRANSFORM transform, guint16 *lut, matrix_shaper *shaper,
+        gboolean shared)
+{
+    transform_entry *entry = g_new(transform_entry, 1);
+    entry->key = *key;
+    entry->shared = shared;
+    entry->refCount = 1;
+    entry->transform = transform;
+    entry->lut = lut;
+    entry->shaper = shaper;
+    G_LOCK(transform_cache);
+    transformCache = g_list_prepend(transformCache, entry);
+    G_UNLOCK(transform_cache);
+    return entry;
+}
+
+/* Drop a reference to a transformation returned by developer_transform() */
+static void transform_cache_release(cmsHTRANSFORM transform)
+{
+    GList *l, *next;
+    int unused = 0;
+    if (transform == NULL)
+        return;
+    G_LOCK(transform_cache);
+    for (l = transformCache; l != NULL; l = next) {
+        transform_entry *entry = l->data;
+        next = l->next;
+        if (entry->transform == transform)
+            entry->refCount--;
+        if (entry->refCount > 0)
+            continue;
+        if (entry->shared && ++unused <= max_unused_transforms)
+            continue;
+        transformCache = g_list_delete_link(transformCache, l);
+        transform_entry_free(entry);
+    }
+    G_UNLOCK(transform_cache);
+}
+
+static void transform_key_profile(transform_key *key, int i,
+                                  const developer_data *d, int type)
+{
+    if (d->registeredProfile[type] != NULL)
+        memcpy(key->profileID[i], d->registeredProfile[type]->id, 16);
+}
+
+static gboolean profile_id_valid(const guint8 id[16])
+{
+    static const guint8 no_id[16];
+    return memcmp(id, no_id, 16) != 0;
+}
+
+/* The profiles from the registry are shared by all developers, so the
+ * transformations are created one at a time. This also lets the threads
+ * converting images with the same settings wait for the first one to
+ * create the transformation instead of creating it again. */
+G_LOCK_DEFINE_STATIC(transform_create);
+
+/* Get the transformation for key from the cache, creating it if needed.
+ * Returns NULL if lcms fails to create it. */
+static transform_entry *developer_transform(developer_data *d,
+        const transform_key *key, int targetProfile)
+{
+    transform_entry *entry;
+    gboolean shared = profile_id_valid(key->profileID[0]) &&
+                      (key->type == lab_transform ||
+                       profile_id_valid(key->profileID[1]));
+    G_LOCK(transform_create);
+    if (shared && (entry = transform_cache_lookup(key)) != NULL) {
+        G_UNLOCK(transform_create);
+        return entry;
+    }
+
+    cmsHTRANSFORM transform = NULL;
+    guint16 *lut = NULL;
+    matrix_shaper *shaper = NULL;
+    if (key->type == color_transform) {
+        cmsHPROFILE prof[5];
+        int i = 0;
+        prof[i++] = d->profile[in_profile];
+        if (d->luminosityProfile != NULL)
+            prof[i++] = d->luminosityProfile;
+        if (d->adjustmentProfile != NULL)
+            prof[i++] = d->adjustmentProfile;
+        if (d->saturationProfile != NULL)
+            prof[i++] = d->saturationProfile;
+        prof[i++] = d->profile[targetProfile];
+        transform = cmsCreateMultiprofileTransform(prof, i,
+                    TYPE_RGB_16, TYPE_RGB_16, d->intent[out_profile], 0);
+        if (transform != NULL && d->colorLutSize > 0)
+            lut = developer_color_lut(transform, d->colorLutSize);
+        else if (transform != NULL && i == 2)
+            shaper = developer_matrix_shaper(prof[0], prof[1],
+                                             d->intent[out_profile]);
+    } else if (key->type == display_transform) {
+        // TODO: We should use TYPE_RGB_'bit_depth' for working profile.
+        transform = cmsCreateTransform(
+                        d->profile[out_profile], TYPE_RGB_8,
+                        d->profile[display_profile], TYPE_RGB_8,
+                        d->intent[display_profile], 0);
+    } else if (key->type == float_transform) {
+        cmsHPROFILE inLinear =
+            uf_colorspaces_create_linear_profile(d->profile[in_profile]);
+        cmsHPROFILE outLinear =
+            uf_colorspaces_create_linear_profile(d->profile[out_profile]);
+        /* Without a transformation the writer falls back to 16 bit. */
+        if (inLinear != NULL && outLinear != NULL)
+            transform = cmsCreateTransform(inLinear, TYPE_RGB_FLT,
+                                           outLinear, TYPE_RGB_FLT,
+                                           d->intent[out_profile], 0);
+        if (inLinear != NULL)
+            cmsCloseProfile(inLinear);
+        if (outLinear != NULL)
+            cmsCloseProfile(outLinear);
+    } else {
+        cmsHPROFILE labProfile = cmsCreateLab2Profile(cmsD50_xyY());
+        transform = cmsCreateTransform(d->profile[in_profile],
+                                       TYPE_RGB_16, labProfile,
+                                       TYPE_Lab_16, INTENT_ABSOLUTE_COLORIMETRIC, 0);
+        cmsCloseProfile(labProfile);
+    }
+    entry = NULL;
+    if (transform != NULL)
+        entry = transform_cache_insert(key, transform, lut, shaper, shared);
+    G_UNLOCK(transform_create);
+    return entry;
+}
+
 static void developer_create_transform(developer_data *d, DeveloperMode mode)
 {
+    transform_key key;
+    transform_entry *entry;
+
     if (!d->updateTransform)
         return;
     d->updateTransform = FALSE;
@@ -418,52 +867,90 @@ static void developer_create_transform(developer_data *d, DeveloperMode mode)
     } else {
         targetProfile = out_profile;
     }
-    if (d->colorTransform != NULL)
-        cmsDeleteTransform(d->colorTransform);
+    /* The new transformations are taken from the cache before releasing
+     * the old ones, which are often the same. */
+    cmsHTRANSFORM oldTransform = d->colorTransform;
+    d->colorTransform = NULL;
+    d->colorLut = NULL;
+    d->colorShaper = NULL;
     if (strcmp(d->profileFile[in_profile], "") == 0 &&
             strcmp(d->profileFile[targetProfile], "") == 0 &&
             d->luminosityProfile == NULL &&
             d->adjustmentProfile == NULL &&
             d->saturationProfile == NULL) {
         /* No transformation at all. */
-        d->colorTransform = NULL;
     } else {
-        cmsHPROFILE prof[5];
-        int i = 0;
-        prof[i++] = d->profile[in_profile];
-        if (d->luminosityProfile != NULL)
-            prof[i++] = d->luminosityProfile;
-        if (d->adjustmentProfile != NULL)
-            prof[i++] = d->adjustmentProfile;
-        if (d->saturationProfile != NULL)
-            prof[i++] = d->saturationProfile;
-        prof[i++] = d->profile[targetProfile];
-        d->colorTransform = cmsCreateMultiprofileTransform(prof, i,
-                            TYPE_RGB_16, TYPE_RGB_16, d->intent[out_profile], 0);
+        /* Clear the padding, keys are compared with memcmp() */
+        memset(&key, 0, sizeof key);
+        key.type = color_transform;
+        transform_key_profile(&key, 0, d, in_profile);
+        transform_key_profile(&key, 1, d, targetProfile);
+        key.intent = d->intent[out_profile];
+        key.colorLutSize = d->colorLutSize;
+        if (d->luminosityProfile != NULL) {
+            key.luminosity = TRUE;
+            key.luminosityCurve = d->luminosityCurveData;
+        }
+        if (d->adjustmentProfile != NULL) {
+            key.adjustment = TRUE;
+            memcpy(key.lightnessAdjustment, d->lightnessAdjustment,
+                   sizeof key.lightnessAdjustment);
+        }
+        if (d->saturationProfile != NULL) {
+            key.saturation = TRUE;
+            key.saturationValue = d->saturation;
+#ifdef UFRAW_CONTRAST
+            key.contrast = d->contrast;
+#endif
+        }
+        entry = developer_transform(d, &key, targetProfile);
+        if (entry != NULL) {
+            d->colorTransform = entry->transform;
+            d->colorLut = entry->lut;
+            d->colorShaper = entry->shaper;
+        }
     }
+    transform_cache_release(oldTransform);
 
-    if (d->working2displayTransform != NULL)
-        cmsDeleteTransform(d->working2displayTransform);
+    oldTransform = d->working2displayTransform;
+    d->working2displayTransform = NULL;
     if (mode == display_developer
             && d->intent[display_profile] != disable_intent
             && strcmp(d->profileFile[out_profile],
                       d->profileFile[display_profile]) != 0) {
-        // TODO: We should use TYPE_RGB_'bit_depth' for working profile.
-        d->working2displayTransform = cmsCreateTransform(
-                                          d->profile[out_profile], TYPE_RGB_8,
-                                          d->profile[display_profile], TYPE_RGB_8,
-                                          d->intent[display_profile], 0);
-    } else {
-        d->working2displayTransform = NULL;
+        memset(&key, 0, sizeof key);
+        key.type = display_transform;
+        transform_key_profile(&key, 0, d, out_profile);
+        transform_key_profile(&key, 1, d, display_profile);
+        key.intent = d->intent[display_profile];
+        entry = developer_transform(d, &key, display_profile);
+        if (entry != NULL)
+            d->working2displayTransform = entry->transform;
     }
-
-    if (d->rgbtolabTransform == NULL) {
-        cmsHPROFILE labProfile = cmsCreateLab2Profile(cmsD50_xyY());
-        d->rgbtolabTransform = cmsCreateTransform(d->profile[in_profile],
-                               TYPE_RGB_16, labProfile,
-                               TYPE_Lab_16, INTENT_ABSOLUTE_COLORIMETRIC, 0);
-        cmsCloseProfile(labProfile);
+    transform_cache_release(oldTransform);
+
+    memset(&key, 0, sizeof key);
+    key.type = lab_transform;
+    transform_key_profile(&key, 0, d, in_profile);
+    entry = developer_transform(d, &key, in_profile);
+    transform_cache_release(d->rgbtolabTransform);
+    d->rgbtolabTransform = entry != NULL ? entry->transform : NULL;
+
+    /* Float TIFF output is transformed in linear light from the input to the
+     * output color space. */
+    oldTransform = d->floatTransform;
+    d->floatTransform = NULL;
+    if (d->floatOutput) {
+        memset(&key, 0, sizeof key);
+        key.type = float_transform;
+        transform_key_profile(&key, 0, d, in_profile);
+        transform_key_profile(&key, 1, d, out_profile);
+        key.intent = d->intent[out_profile];
+        entry = developer_transform(d, &key, out_profile);
+        if (entry != NULL)
+            d->floatTransform = entry->transform;
     }
+    transform_cache_release(oldTransform);
 }
 
 static gboolean test_adjustments(const lightness_adjustment values[max_adjustments],
@@ -555,68 +1042,61 @@ void developer_prepare(developer_data *d, conf_data *conf,
         exposure = (guint64)exposure * d->rgbMax / conf->ExposureNorm;
     if (exposure >= 0x10000) d->restoreDetails = clip_details;
     if (exposure <= 0x10000) clipHighlights = digital_highlights;
-    /* Check if gamma curve data has changed. */
-    if (in->gamma != d->gamma || in->linear != d->linear ||
-            exposure != d->exposure || clipHighlights != d->clipHighlights ||
-            memcmp(baseCurve, &d->baseCurveData, sizeof(CurveData)) != 0) {
+    /* The gamma curve is composed of the film curve, the base curve and
+     * the gamma table. Each of them is rebuilt only when its own settings
+     * change, so that changing the exposure of digital highlights does not
+     * rebuild anything. */
+    gboolean updateGammaCurve = FALSE;
+    if (memcmp(baseCurve, &d->baseCurveData, sizeof(CurveData)) != 0) {
         d->baseCurveData = *baseCurve;
-        guint16 BaseCurve[0x10000];
         CurveSample *cs = CurveSampleInit(0x10000, 0x10000);
         ufraw_message(UFRAW_RESET, NULL);
         if (CurveDataSample(baseCurve, cs) != UFRAW_SUCCESS) {
             ufraw_message(UFRAW_REPORT, NULL);
             for (i = 0; i < 0x10000; i++) cs->m_Samples[i] = i;
         }
-        for (i = 0; i < 0x10000; i++) BaseCurve[i] = cs->m_Samples[i];
+        for (i = 0; i < 0x10000; i++) d->baseCurve[i] = cs->m_Samples[i];
         CurveSampleFree(cs);
-
+        updateGammaCurve = TRUE;
+    }
+    if (clipHighlights != d->clipHighlights ||
+            (clipHighlights == film_highlights && exposure != d->exposure)) {
+        developer_film_curve(d->filmCurve, clipHighlights, exposure);
+        updateGammaCurve = TRUE;
+    }
+    d->exposure = exposure;
+    d->clipHighlights = clipHighlights;
+    if (in->gamma != d->gamma || in->linear != d->linear) {
         d->gamma = in->gamma;
         d->linear = in->linear;
-        d->exposure = exposure;
-        d->clipHighlights = clipHighlights;
-        guint16 FilmCurve[0x10000];
-        if (d->clipHighlights == film_highlights) {
-            /* Exposure is set by FilmCurve[].
-             * Set initial slope to d->exposuse/0x10000 */
-            double a = findExpCoeff((double)d->exposure / 0x10000);
-            for (i = 0; i < 0x10000; i++) FilmCurve[i] =
-                    (1 - exp(-a * i / 0x10000)) / (1 - exp(-a)) * 0xFFFF;
-        } else { /* digital highlights */
-            for (i = 0; i < 0x10000; i++) FilmCurve[i] = i;
-        }
-        double a, b, c, g;
-        /* The parameters of the linearized gamma curve are set in a way that
-         * keeps the curve continuous and smooth at the connecting point.
-         * d->linear also changes the real gamma used for the curve (g) in
-         * a way that keeps the derivative at i=0x10000 constant.
-         * This way changing the linearity changes the curve behaviour in
-         * the shadows, but has a minimal effect on the rest of the range. */
-        if (d->linear < 1.0) {
-            g = d->gamma * (1.0 - d->linear) / (1.0 - d->gamma * d->linear);
-            a = 1.0 / (1.0 + d->linear * (g - 1));
-            b = d->linear * (g - 1) * a;
-            c = pow(a * d->linear + b, g) / d->linear;
-        } else {
-            a = b = g = 0.0;
-            c = 1.0;
-        }
-        for (i = 0; i < 0x10000; i++)
-            if (BaseCurve[FilmCurve[i]] < 0x10000 * d->linear)
-                d->gammaCurve[i] = MIN(c * BaseCurve[FilmCurve[i]], 0xFFFF);
-            else
-                d->gammaCurve[i] = MIN(pow(a * BaseCurve[FilmCurve[i]] / 0x10000 + b,
-                                           g) * 0x10000, 0xFFFF);
+        developer_gamma_table(d->gammaTable, d->gamma, d->linear);
+        updateGammaCurve = TRUE;
     }
+    if (updateGammaCurve)
+        for (i = 0; i < 0x10000; i++)
+            d->gammaCurve[i] = d->gammaTable[d->baseCurve[d->filmCurve[i]]];
     developer_profile(d, in_profile, in);
     developer_profile(d, out_profile, out);
+    if (conf->colorLut != d->colorLutSize) {
+        d->colorLutSize = conf->colorLut;
+        d->updateTransform = TRUE;
+    }
     if (conf->intent[out_profile] != d->intent[out_profile]) {
         d->intent[out_profile] = conf->intent[out_profile];
         d->updateTransform = TRUE;
     }
+    /* FITS output stays in the input color space, as for 16 bit. */
+    gboolean floatOutput = mode == file_developer && out->BitDepth == 32 &&
+                           conf->type == tiff_type;
+    if (floatOutput != d->floatOutput) {
+        d->floatOutput = floatOutput;
+        d->updateTransform = TRUE;
+    }
     /* For auto-tools we ignore all the output settings:
      * luminosity, saturation, output profile and proofing. */
     if (mode == auto_developer) {
         developer_create_transform(d, mode);
+        developer_linear_lut(d, mode);
         return;
     }
     developer_profile(d, display_profile, display);
@@ -694,6 +1174,7 @@ void developer_prepare(developer_data *d, conf_data *conf,
         d->updateTransform = TRUE;
     }
     developer_create_transform(d, mode);
+    developer_linear_lut(d, mode);
 }
 
 static void apply_matrix(const developer_data *d,
@@ -731,20 +1212,10 @@ static const double rgb_xyz[3][3] = {			/* RGB from XYZ */
 // Convert linear RGB to CIE-LCh
 void uf_rgb_to_cielch(gint64 rgb[3], float lch[3])
 {
-    int c, cc, i;
-    float r, xyz[3], lab[3];
-    // The use of static varibles here should be thread safe.
-    // In the worst case cbrt[] will be calculated more than once.
-    static gboolean firstRun = TRUE;
-    static float cbrt[0x10000];
-
-    if (firstRun) {
-        for (i = 0; i < 0x10000; i++) {
-            r = i / 65535.0;
-            cbrt[i] = r > 0.008856 ? pow(r, 1 / 3.0) : 7.787 * r + 16 / 116.0;
-        }
-        firstRun = FALSE;
-    }
+    int c, cc;
+    float xyz[3], lab[3];
+    const float *cbrt = uf_cielab_cbrt_table();
+
     xyz[0] = xyz[1] = xyz[2] = 0.5;
     for (c = 0; c < 3; c++)
         for (cc = 0; cc < 3; cc++)
@@ -790,6 +1261,65 @@ void uf_cielch_to_rgb(float lch[3], gint64 rgb[3])
     }
 }
 
+/*
+ * Restore the details of a clipped pixel in CIE-LCh, taking the lightness
+ * of the unclipped pixel and the chroma and hue of the clipped pixel.
+ * This gives the result of uf_rgb_to_cielch() on both pixels followed by
+ * uf_cielch_to_rgb(), up to float rounding. Since the chroma and the hue
+ * are taken together, the a and b of the clipped pixel are used directly
+ * instead of going through the polar coordinates, and only the Y of the
+ * unclipped pixel is needed. This avoids sqrt(), atan2(), sin(), cos()
+ * and pow(), which made overexposed areas several times slower.
+ */
+static void restore_lch(const gint64 unclipped[3], const gint64 clipped[3],
+                        gint64 rgb[3])
+{
+    const float *cbrt = uf_cielab_cbrt_table();
+    const float epsilon = 0.008856, kappa = 903.3;
+    float xyz[3], fx, fy, fz, xr, yr, zr, L, a, b;
+    double cube;
+    int c;
+
+    xyz[0] = xyz[1] = xyz[2] = 0.5;
+    L = 0.5;
+    for (c = 0; c < 3; c++) {
+        xyz[0] += xyz_rgb[0][c] * clipped[c];
+        xyz[1] += xyz_rgb[1][c] * clipped[c];
+        xyz[2] += xyz_rgb[2][c] * clipped[c];
+        L += xyz_rgb[1][c] * unclipped[c];
+    }
+    for (c = 0; c < 3; c++)
+        xyz[c] = cbrt[MAX(MIN((int)xyz[c], 0xFFFF), 0)];
+    L = 116 * cbrt[MAX(MIN((int)L, 0xFFFF), 0)] - 16;
+    a = 500 * (xyz[0] - xyz[1]);
+    b = 200 * (xyz[1] - xyz[2]);
+
+    /* The inverse conversion of uf_cielch_to_rgb() */
+    if (L <= kappa * epsilon) {
+        yr = L / kappa;
+    } else {
+        cube = (L + 16.0) / 116.0;
+        yr = cube * cube * cube;
+    }
+    fy = (yr <= epsilon) ? ((kappa * yr + 16.0) / 116.0) : ((L + 16.0) / 116.0);
+    fz = fy - b / 200.0;
+    fx = a / 500.0 + fy;
+    cube = (double)fz * fz * fz;
+    zr = (cube <= epsilon) ? ((116.0 * fz - 16.0) / kappa) : cube;
+    cube = (double)fx * fx * fx;
+    xr = (cube <= epsilon) ? ((116.0 * fx - 16.0) / kappa) : cube;
+
+    xyz[0] = xr * 65535.0 - 0.5;
+    xyz[1] = yr * 65535.0 - 0.5;
+    xyz[2] = zr * 65535.0 - 0.5;
+
+    for (c = 0; c < 3; c++) {
+        float tmpf = rgb_xyz[c][0] * xyz[0] + rgb_xyz[c][1] * xyz[1] +
+                     rgb_xyz[c][2] * xyz[2];
+        rgb[c] = MAX(tmpf, 0);
+    }
+}
+
 void uf_raw_to_cielch(const developer_data *d,
                       const guint16 raw[4],
                       float lch[3])
@@ -851,9 +1381,110 @@ static void MaxMidMin(const gint64 p[3], int *maxc, int *midc, int *minc)
     *minc = min;
 }
 
+static void develop_linear_pixels(guint16 *in, guint16 *out,
+                                  developer_data *d, int count);
+
+/* Apply the color transformation to count pixels through d->colorLut,
+ * using tetrahedral interpolation between the grid points. */
+static void develop_color_lut(const developer_data *d, guint16 *pix,
+                              int count)
+{
+    const int size = d->colorLutSize;
+    const int sr = 3 * size * size, sg = 3 * size, sb = 3;
+    int i, c;
+    for (i = 0; i < count; i++, pix += 3) {
+        int index = 0, f[3];
+        for (c = 0; c < 3; c++) {
+            /* f[c] is the position between the grid points in 1/0xFFFF */
+            int x = pix[c] * (size - 1);
+            int grid = x / 0xFFFF;
+            f[c] = x - grid * 0xFFFF;
+            if (grid == size - 1) {
+                grid--;
+                f[c] = 0xFFFF;
+            }
+            index += grid * (c == 0 ? sr : c == 1 ? sg : sb);
+        }
+        /* The corners of the tetrahedron are reached by stepping along
+         * the channels in decreasing order of their positions. */
+        int s1, s2, f1, f2, f3;
+        if (f[0] >= f[1]) {
+            if (f[1] >= f[2]) {
+                s1 = sr, s2 = sr + sg, f1 = f[0], f2 = f[1], f3 = f[2];
+            } else if (f[0] >= f[2]) {
+                s1 = sr, s2 = sr + sb, f1 = f[0], f2 = f[2], f3 = f[1];
+            } else {
+                s1 = sb, s2 = sb + sr, f1 = f[2], f2 = f[0], f3 = f[1];
+            }
+        } else {
+            if (f[0] >= f[2]) {
+                s1 = sg, s2 = sg + sr, f1 = f[1], f2 = f[0], f3 = f[2];
+            } else if (f[1] >= f[2]) {
+                s1 = sg, s2 = sg + sb, f1 = f[1], f2 = f[2], f3 = f[0];
+            } else {
+                s1 = sb, s2 = sb + sg, f1 = f[2], f2 = f[1], f3 = f[0];
+            }
+        }
+        const guint16 *p0 = d->colorLut + index;
+        const guint16 *p1 = p0 + s1, *p2 = p0 + s2, *p3 = p0 + sr + sg + sb;
+        for (c = 0; c < 3; c++) {
+            /* The weights add up to 0xFFFF, so the sum fits in 32 bits */
+            guint32 v = p0[c] * (guint32)(0xFFFF - f1) + p1[c] * (guint32)(f1 - f2) +
+                        p2[c] * (guint32)(f2 - f3) + p3[c] * (guint32)f3;
+            pix[c] = (v + 0x7FFF) / 0xFFFF;
+        }
+    }
+}
+
+/* Apply the matrix shaper to count pixels */
+static void develop_matrix_shaper(const matrix_shaper *shaper, guint16 *pix,
+                                  int count)
+{
+    int i = 0, c, cc;
+#ifdef __SSE2__
+    /* Four pixels at a time, in the same order and precision as below.
+     * The table lookups are scalar, SSE2 has no gather. */
+    __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+    __m128 white = _mm_set1_ps(0xFFFF), half = _mm_set1_ps(0.5);
+    for (; i + 4 <= count; i += 4, pix += 12) {
+        __m128 lin[3];
+        gint32 index[4];
+        for (c = 0; c < 3; c++)
+            lin[c] = _mm_set_ps(shaper->linear[c][pix[9 + c]],
+                                shaper->linear[c][pix[6 + c]],
+                                shaper->linear[c][pix[3 + c]],
+                                shaper->linear[c][pix[c]]);
+        for (cc = 0; cc < 3; cc++) {
+            __m128 v = _mm_mul_ps(_mm_set1_ps(shaper->matrix[cc][0]), lin[0]);
+            v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(shaper->matrix[cc][1]),
+                                         lin[1]));
+            v = _mm_add_ps(v, _mm_mul_ps(_mm_set1_ps(shaper->matrix[cc][2]),
+                                         lin[2]));
+            v = _mm_sqrt_ps(_mm_min_ps(_mm_max_ps(v, zero), one));
+            v = _mm_add_ps(_mm_mul_ps(v, white), half);
+            _mm_storeu_si128((__m128i *)index, _mm_cvttps_epi32(v));
+            for (c = 0; c < 4; c++)
+                pix[3 * c + cc] = shaper->shaper[cc][index[c]];
+        }
+    }
+#endif
+    for (; i < count; i++, pix += 3) {
+        float lin[3];
+        for (c = 0; c < 3; c++)
+            lin[c] = shaper->linear[c][pix[c]];
+        for (cc = 0; cc < 3; cc++) {
+            float v = shaper->matrix[cc][0] * lin[0] +
+                      shaper->matrix[cc][1] * lin[1] +
+                      shaper->matrix[cc][2] * lin[2];
+            v = sqrtf(MIN(MAX(v, 0), 1));
+            pix[cc] = shaper->shaper[cc][(int)(v * 0xFFFF + 0.5f)];
+        }
+    }
+}
+
 void develop(void *po, guint16 pix[4], developer_data *d, int mode, int count)
 {
-    guint16 c, tmppix[3], *buf;
+    guint16 *buf;
     int i;
     if (mode == 16) buf = po;
     else buf = g_alloca(count * 6);
@@ -863,27 +1494,33 @@ void develop(void *po, guint16 pix[4], developer_data *d, int mode, int count)
     if (count > 16)				\
         default(none)				\
         shared(d, buf, count, pix)			\
-        private(i, tmppix, c)
+        private(i)
     {
         int chunk = count / omp_get_num_threads() + 1;
         int offset = chunk * omp_get_thread_num();
         int width = (chunk > count - offset) ? count - offset : chunk;
-        for (i = offset; i < offset + width; i++) {
-            develop_linear(pix + i * 4, tmppix, d);
-            for (c = 0; c < 3; c++)
-                buf[i * 3 + c] = d->gammaCurve[tmppix[c]];
-        }
-        if (d->colorTransform != NULL)
+        develop_linear_pixels(pix + offset * 4, buf + offset * 3, d, width);
+        if (!d->linearLutGamma)
+            for (i = offset * 3; i < (offset + width) * 3; i++)
+                buf[i] = d->gammaCurve[buf[i]];
+        if (d->colorLut != NULL)
+            develop_color_lut(d, buf + offset * 3, width);
+        else if (d->colorShaper != NULL)
+            develop_matrix_shaper(d->colorShaper, buf + offset * 3, width);
+        else if (d->colorTransform != NULL)
             cmsDoTransform(d->colorTransform,
                            buf + offset * 3, buf + offset * 3, width);
     }
 #else
-    for (i = 0; i < count; i++) {
-        develop_linear(pix + i * 4, tmppix, d);
-        for (c = 0; c < 3; c++)
-            buf[i * 3 + c] = d->gammaCurve[tmppix[c]];
-    }
-    if (d->colorTransform != NULL)
+    develop_linear_pixels(pix, buf, d, count);
+    if (!d->linearLutGamma)
+        for (i = 0; i < 3 * count; i++)
+            buf[i] = d->gammaCurve[buf[i]];
+    if (d->colorLut != NULL)
+        develop_color_lut(d, buf, count);
+    else if (d->colorShaper != NULL)
+        develop_matrix_shaper(d->colorShaper, buf, count);
+    else if (d->colorTransform != NULL)
         cmsDoTransform(d->colorTransform, buf, buf, count);
 #endif
 
@@ -939,6 +1576,23 @@ static void develop_grayscale(guint16 *pixel, const developer_data *d)
     pixel[0] = pixel[1] = pixel[2] = spot;
 }
 
+/* Apply the color matrix to an unclipped pixel, and compress the
+ * highlights that are pushed above 0xFFFF */
+static void develop_unclipped(const developer_data *d, gint64 tmppix[4])
+{
+    unsigned c;
+    if (d->useMatrix)
+        apply_matrix(d, tmppix, tmppix);
+    gint64 max = tmppix[0];
+    for (c = 1; c < 3; c++) max = MAX(tmppix[c], max);
+    if (max > 0xFFFF) {
+        gint64 unclippedLum = max;
+        gint64 clippedLum = 0xFFFF;
+        gint64 lum = clippedLum + (unclippedLum - clippedLum) * 1 / 4;
+        for (c = 0; c < 3; c++) tmppix[c] = tmppix[c] * lum / max;
+    }
+}
+
 void develop_linear(guint16 in[4], guint16 out[3], developer_data *d)
 {
     unsigned c;
@@ -973,14 +1627,7 @@ void develop_linear(guint16 in[4], guint16 out[3], developer_data *d)
         for (c = 0; c < 3; c++) tmppix[c] = MIN(tmppix[c], d->exposure);
         cond_apply_matrix(d, tmppix, clippedPix);
         if (d->restoreDetails == restore_lch_details) {
-            float lch[3], clippedLch[3], unclippedLch[3];
-            uf_rgb_to_cielch(unclippedPix, unclippedLch);
-            uf_rgb_to_cielch(clippedPix, clippedLch);
-            //lch[0] = clippedLch[0] + (unclippedLch[0]-clippedLch[0]) * x;
-            lch[0] = unclippedLch[0];
-            lch[1] = clippedLch[1];
-            lch[2] = clippedLch[2];
-            uf_cielch_to_rgb(lch, tmppix);
+            restore_lch(unclippedPix, clippedPix, tmppix);
         } else { /* restore_hsv_details */
             int maxc, midc, minc;
             MaxMidMin(unclippedPix, &maxc, &midc, &minc);
@@ -1026,18 +1673,224 @@ void develop_linear(guint16 in[4], guint16 out[3], developer_data *d)
             tmppix[midc] = lum * (0x10000 - sat + sat * hue / 0x10000) / 0x10000;
         }
     } else { /* !clipped */
-        if (d->useMatrix)
-            apply_matrix(d, tmppix, tmppix);
-        gint64 max = tmppix[0];
-        for (c = 1; c < 3; c++) max = MAX(tmppix[c], max);
-        if (max > 0xFFFF) {
-            gint64 unclippedLum = max;
-            gint64 clippedLum = 0xFFFF;
-            gint64 lum = clippedLum + (unclippedLum - clippedLum) * 1 / 4;
-            for (c = 0; c < 3; c++) tmppix[c] = tmppix[c] * lum / max;
-        }
+        develop_unclipped(d, tmppix);
     }
     for (c = 0; c < 3; c++)
         out[c] = MIN(MAX(tmppix[c], 0), 0xFFFF);
     develop_grayscale(out, d);
 }
+
+/* Develop count pixels to 32 bit floats in linear light, where 1.0 is the
+ * full exposure. Highlights are neither clipped nor restored, and there is
+ * no gamma curve, so the values above 1.0 are kept for HDR merging. The
+ * luminosity curve, saturation, lightness adjustments and grayscale
+ * conversion are not applied either. */
+void develop_float(float *out, guint16 pix[4], developer_data *d, int count)
+{
+    float scale[4], matrix[3][4];
+    int i, c, cc;
+    for (c = 0; c < 4; c++) {
+        /* develop_linear() scales by rgbWB/0x10000 and d->exposure/d->max,
+         * where d->exposure is "1.0" (full exposure) */
+        scale[c] = c < (int)d->colors ?
+                   (double)d->rgbWB[c] * d->exposure / d->max / 0x10000 /
+                   0x10000 : 0;
+        for (cc = 0; cc < 3; cc++) {
+            if (c >= (int)d->colors)
+                matrix[cc][c] = 0;
+            else if (d->useMatrix)
+                matrix[cc][c] = d->colorMatrix[cc][c] / (float)0x10000;
+            else
+                matrix[cc][c] = (d->colors == 1 || c == cc) ? 1 : 0;
+        }
+    }
+    for (i = 0; i < count; i++) {
+        float in[4];
+        for (c = 0; c < 4; c++)
+            in[c] = pix[4 * i + c] * scale[c];
+        for (cc = 0; cc < 3; cc++)
+            out[3 * i + cc] = MAX(matrix[cc][0] * in[0] + matrix[cc][1] * in[1] +
+                                  matrix[cc][2] * in[2] + matrix[cc][3] * in[3],
+                                  0);
+    }
+    if (d->floatTransform != NULL)
+        cmsDoTransform(d->floatTransform, out, out, count);
+}
+
+/*
+ * develop_linear() for count pixels at a time. On x86 CPUs with AVX four
+ * pixels are developed together in the lanes of a vector of doubles. The
+ * doubles hold the intermediate products of develop_linear() exactly, so
+ * truncating them after each division gives the same result as the
+ * integer code. Clipped pixels that need their details restored are
+ * redone by develop_linear().
+ * MinGW does not align the stack for AVX variables, so Windows builds use
+ * the integer code.
+ */
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) && \
+    !defined(_WIN32)
+#define UFRAW_DEVELOP_AVX
+#endif
+
+#ifdef UFRAW_DEVELOP_AVX
+#include <immintrin.h>
+
+/* Truncate towards zero, as the integer division does */
+#define DEVELOP_TRUNC(x) _mm256_round_pd(x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)
+
+__attribute__((target("avx")))
+static void develop_linear_avx(const guint16 *in, guint16 *out,
+                               const developer_data *d,
+                               const double matrix[3][4], int count)
+{
+    __m256d max = _mm256_set1_pd(d->max);
+    __m256d scale = _mm256_set1_pd(
+                        d->clipHighlights == film_highlights ? 0x10000 : d->exposure);
+    __m256d zero = _mm256_setzero_pd();
+    __m256d white = _mm256_set1_pd(0xFFFF);
+    __m256d pix[4], rgb[3];
+    const gint32 *lut = d->linearLut;
+    double lanes[3][4];
+    int i, k;
+    unsigned c, cc;
+
+    for (i = 0; i + 4 <= count; i += 4, in += 16, out += 12) {
+        __m256d wbMax = zero;
+        for (c = 0; c < 4; c++)
+            pix[c] = zero;
+        for (c = 0; c < d->colors; c++) {
+            if (lut != NULL) {
+                const gint32 *l = lut + c * 0x10000;
+                pix[c] = _mm256_cvtepi32_pd(_mm_set_epi32(l[in[12 + c]],
+                                            l[in[8 + c]], l[in[4 + c]], l[in[c]]));
+                continue;
+            }
+            __m256d t = _mm256_cvtepi32_pd(
+                            _mm_set_epi32(in[12 + c], in[8 + c], in[4 + c], in[c]));
+            /* Multiplying by a power of 2 is exact */
+            t = DEVELOP_TRUNC(_mm256_mul_pd(t,
+                                            _mm256_set1_pd(d->rgbWB[c] / 65536.0)));
+            wbMax = _mm256_max_pd(wbMax, t);
+            t = _mm256_mul_pd(_mm256_min_pd(t, max), scale);
+            pix[c] = DEVELOP_TRUNC(_mm256_div_pd(t, max));
+        }
+        if (d->colors == 1)
+            pix[1] = pix[2] = pix[0];
+        if (d->useMatrix) {
+            for (cc = 0; cc < 3; cc++) {
+                __m256d t = _mm256_mul_pd(pix[0], _mm256_set1_pd(matrix[cc][0]));
+                for (c = 1; c < 4; c++)
+                    t = _mm256_add_pd(t, _mm256_mul_pd(pix[c],
+                                                       _mm256_set1_pd(matrix[cc][c])));
+                t = DEVELOP_TRUNC(_mm256_mul_pd(t, _mm256_set1_pd(1.0 / 0x10000)));
+                rgb[cc] = _mm256_max_pd(t, zero);
+            }
+        } else {
+            for (cc = 0; cc < 3; cc++)
+                rgb[cc] = pix[cc];
+        }
+        /* Compress the highlights that the matrix pushed above 0xFFFF */
+        __m256d rgbMax = _mm256_max_pd(_mm256_max_pd(rgb[0], rgb[1]), rgb[2]);
+        __m256d over = _mm256_cmp_pd(rgbMax, white, _CMP_GT_OQ);
+        if (!_mm256_testz_pd(over, over)) {
+            rgbMax = _mm256_max_pd(rgbMax, white);
+            __m256d lum = _mm256_add_pd(white, DEVELOP_TRUNC(_mm256_mul_pd(
+                                            _mm256_sub_pd(rgbMax, white), _mm256_set1_pd(0.25))));
+            for (cc = 0; cc < 3; cc++) {
+                __m256d t = DEVELOP_TRUNC(_mm256_div_pd(
+                                              _mm256_mul_pd(rgb[cc], lum), rgbMax));
+                rgb[cc] = _mm256_blendv_pd(rgb[cc], t, over);
+            }
+        }
+        for (cc = 0; cc < 3; cc++)
+            _mm256_storeu_pd(lanes[cc], _mm256_min_pd(rgb[cc], white));
+        for (k = 0; k < 4; k++)
+            for (cc = 0; cc < 3; cc++)
+                out[k * 3 + cc] = lanes[cc][k];
+        if (d->grayscaleMode != grayscale_none)
+            for (k = 0; k < 4; k++)
+                develop_grayscale(out + k * 3, d);
+        if (d->restoreDetails != clip_details) {
+            int clipped = 0;
+            if (lut != NULL) {
+                for (k = 0; k < 4; k++)
+                    for (c = 0; c < d->colors; c++)
+                        if (in[k * 4 + c] >= d->clipLimit[c])
+                            clipped |= 1 << k;
+            } else {
+                clipped = _mm256_movemask_pd(_mm256_cmp_pd(wbMax, max,
+                                             _CMP_GT_OQ));
+            }
+            for (k = 0; k < 4; k++)
+                if (clipped & (1 << k))
+                    develop_linear((guint16 *)in + k * 4, out + k * 3,
+                                   (developer_data *)d);
+        }
+        if (d->linearLutGamma)
+            for (k = 0; k < 12; k++)
+                out[k] = d->gammaCurve[out[k]];
+    }
+}
+#endif /*UFRAW_DEVELOP_AVX*/
+
+/* Develop count pixels through d->linearLut, see developer_linear_lut() */
+static void develop_linear_lut(const guint16 *in, guint16 *out,
+                               developer_data *d, int count)
+{
+    const gint32 *lut = d->linearLut;
+    gint64 tmppix[4];
+    int i;
+    unsigned c;
+
+    for (i = 0; i < count; i++, in += 4, out += 3) {
+        for (c = 0; c < d->colors; c++)
+            if (in[c] >= d->clipLimit[c])
+                break;
+        if (c < d->colors) {
+            develop_linear((guint16 *)in, out, d);
+            if (d->linearLutGamma)
+                for (c = 0; c < 3; c++)
+                    out[c] = d->gammaCurve[out[c]];
+            continue;
+        }
+        for (c = 0; c < d->colors; c++)
+            tmppix[c] = lut[c * 0x10000 + in[c]];
+        if (d->colors == 1)
+            tmppix[1] = tmppix[2] = tmppix[0];
+        develop_unclipped(d, tmppix);
+        if (d->linearLutGamma) {
+            for (c = 0; c < 3; c++)
+                out[c] = d->gammaCurve[MIN(MAX(tmppix[c], 0), 0xFFFF)];
+        } else {
+            for (c = 0; c < 3; c++)
+                out[c] = MIN(MAX(tmppix[c], 0), 0xFFFF);
+            develop_grayscale(out, d);
+        }
+    }
+}
+
+/* Develop count pixels of in[4] to the linear out[3], or through the
+ * gamma curve if d->linearLutGamma is set. */
+static void develop_linear_pixels(guint16 *in, guint16 *out,
+                                  developer_data *d, int count)
+{
+    int i = 0;
+#ifdef UFRAW_DEVELOP_AVX
+    if (__builtin_cpu_supports("avx") && count >= 4) {
+        double matrix[3][4];
+        unsigned c, cc;
+        /* The unused columns are zero, so that all four can be summed */
+        for (cc = 0; cc < 3; cc++)
+            for (c = 0; c < 4; c++)
+                matrix[cc][c] = c < d->colors ? d->colorMatrix[cc][c] : 0;
+        develop_linear_avx(in, out, d, matrix, count);
+        i = count / 4 * 4;
+    }
+#endif
+    if (d->linearLut != NULL)
+        develop_linear_lut(in + i * 4, out + i * 3, d, count - i);
+    else
+        for (; i < count; i++)
+            develop_linear(in + i * 4, out + i * 3, d);
+}
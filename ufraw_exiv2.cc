@@ -39,7 +39,7 @@ static void uf_strlcpy_to_utf8(char *dest, size_t dest_max,
     }
 }
 
-extern "C" int ufraw_exif_read_input(ufraw_data *uf)
+static int uf_exif_read_input(ufraw_data *uf)
 {
     /* Redirect exiv2 errors to a string buffer */
     std::ostringstream stderror;
@@ -268,7 +268,7 @@ static Exiv2::ExifData ufraw_prepare_exifdata(ufraw_data *uf)
     return exifData;
 }
 
-extern "C" int ufraw_exif_prepare_output(ufraw_data *uf)
+static int uf_exif_prepare_output(ufraw_data *uf)
 {
     /* Redirect exiv2 errors to a string buffer */
     std::ostringstream stderror;
@@ -336,7 +336,7 @@ extern "C" int ufraw_exif_prepare_output(ufraw_data *uf)
 
 }
 
-extern "C" int ufraw_exif_write(ufraw_data *uf)
+static int uf_exif_write(ufraw_data *uf)
 {
     /* Redirect exiv2 errors to a string buffer */
     std::ostringstream stderror;
@@ -375,7 +375,47 @@ extern "C" int ufraw_exif_write(ufraw_data *uf)
     }
 }
 
+/*
+ * Exiv2 is used from the threads of the batch pipeline. Its XMP toolkit
+ * must be initialized before that, and the redirection of std::cerr is
+ * process wide, so the calls are serialized.
+ */
+G_LOCK_DEFINE_STATIC(exiv2);
+
+extern "C" void ufraw_exif_init(void)
+{
+    Exiv2::XmpParser::initialize();
+}
+
+extern "C" int ufraw_exif_read_input(ufraw_data *uf)
+{
+    G_LOCK(exiv2);
+    int status = uf_exif_read_input(uf);
+    G_UNLOCK(exiv2);
+    return status;
+}
+
+extern "C" int ufraw_exif_prepare_output(ufraw_data *uf)
+{
+    G_LOCK(exiv2);
+    int status = uf_exif_prepare_output(uf);
+    G_UNLOCK(exiv2);
+    return status;
+}
+
+extern "C" int ufraw_exif_write(ufraw_data *uf)
+{
+    G_LOCK(exiv2);
+    int status = uf_exif_write(uf);
+    G_UNLOCK(exiv2);
+    return status;
+}
+
 #else
+extern "C" void ufraw_exif_init(void)
+{
+}
+
 extern "C" int ufraw_exif_read_input(ufraw_data *uf)
 {
     (void)uf;
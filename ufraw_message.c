@@ -128,13 +128,94 @@ void ufraw_batch_messenger(char *message)
     g_printerr("%s%c", message, message[strlen(message) - 1] != '\n' ? '\n' : 0);
 }
 
+static ufraw_context default_context;
+#if GLIB_CHECK_VERSION(2,32,0)
+static GPrivate current_context = G_PRIVATE_INIT(NULL);
+#else
+static GStaticPrivate current_context = G_STATIC_PRIVATE_INIT;
+#endif
+
+ufraw_context *ufraw_context_new(void)
+{
+    return g_new0(ufraw_context, 1);
+}
+
+void ufraw_context_free(ufraw_context *context)
+{
+    if (context == NULL) return;
+    g_free(context->logBuffer);
+    g_free(context->errorBuffer);
+    if (context->heldMessages != NULL) {
+        guint i;
+        for (i = 0; i < context->heldMessages->len; i++)
+            g_free(g_ptr_array_index(context->heldMessages, i));
+        g_ptr_array_free(context->heldMessages, TRUE);
+    }
+    ufraw_timings_free(context->timings);
+    g_free(context);
+}
+
+/* Make context current for the calling thread and return the previous one.
+ * NULL selects the default context. */
+ufraw_context *ufraw_context_set(ufraw_context *context)
+{
+    ufraw_context *prev = ufraw_context_get();
+#if GLIB_CHECK_VERSION(2,32,0)
+    g_private_set(&current_context, context);
+#else
+    g_static_private_set(&current_context, context, NULL);
+#endif
+    return prev;
+}
+
+/* Return the context set for the calling thread, or NULL if it uses the
+ * default context. */
+ufraw_context *ufraw_context_get(void)
+{
+#if GLIB_CHECK_VERSION(2,32,0)
+    return g_private_get(&current_context);
+#else
+    return g_static_private_get(&current_context);
+#endif
+}
+
+static ufraw_context *context_current(void)
+{
+    ufraw_context *context = ufraw_context_get();
+    return context != NULL ? context : &default_context;
+}
+
+/* Return the context of the calling thread, which is the default context
+ * if the thread did not set one. */
+ufraw_context *ufraw_context_current(void)
+{
+    return context_current();
+}
+
+static void context_messenger(ufraw_context *context, char *message,
+                              void *parentWindow)
+{
+    if (context->heldMessages != NULL && parentWindow == NULL) {
+        if (message != NULL)
+            g_ptr_array_add(context->heldMessages, g_strdup(message));
+        return;
+    }
+    ufraw_messenger(message, parentWindow);
+}
+
+ufraw_progress_func ufraw_progress_current(void)
+{
+    ufraw_context *context = ufraw_context_get();
+    if (context != NULL && context->progress != NULL)
+        return context->progress;
+    return ufraw_progress;
+}
+
 char *ufraw_message(int code, const char *format, ...)
 {
-    // TODO: The following static variables are not thread-safe
-    static char *logBuffer = NULL;
-    static char *errorBuffer = NULL;
-    static gboolean errorFlag = FALSE;
+    // The parent window belongs to the GUI, which uses a single thread.
     static void *parentWindow = NULL;
+    ufraw_context *context = context_current();
     char *message = NULL;
     void *saveParentWindow;
 
@@ -151,35 +232,37 @@ char *ufraw_message(int code, const char *format, ...)
     }
     switch (code) {
         case UFRAW_SET_ERROR:
-            errorFlag = TRUE;
+            context->errorFlag = TRUE;
             // fall through
         case UFRAW_SET_WARNING:
-            errorBuffer = ufraw_message_buffer(errorBuffer, message);
+            context->errorBuffer =
+                ufraw_message_buffer(context->errorBuffer, message);
             // fall through
         case UFRAW_SET_LOG:
         case UFRAW_DCRAW_SET_LOG:
-            logBuffer = ufraw_message_buffer(logBuffer, message);
+            context->logBuffer =
+                ufraw_message_buffer(context->logBuffer, message);
             g_free(message);
             return NULL;
         case UFRAW_GET_ERROR:
-            if (!errorFlag) return NULL;
+            if (!context->errorFlag) return NULL;
             // fall through
         case UFRAW_GET_WARNING:
-            return errorBuffer;
+            return context->errorBuffer;
         case UFRAW_GET_LOG:
-            return logBuffer;
+            return context->logBuffer;
         case UFRAW_CLEAN:
-            g_free(logBuffer);
-            logBuffer = NULL;
+            g_free(context->logBuffer);
+            context->logBuffer = NULL;
             // fall through
         case UFRAW_RESET:
-            g_free(errorBuffer);
-            errorBuffer = NULL;
-            errorFlag = FALSE;
+            g_free(context->errorBuffer);
+            context->errorBuffer = NULL;
+            context->errorFlag = FALSE;
             return NULL;
         case UFRAW_BATCH_MESSAGE:
             if (parentWindow == NULL)
-                ufraw_messenger(message, parentWindow);
+                context_messenger(context, message, parentWindow);
             g_free(message);
             return NULL;
         case UFRAW_INTERACTIVE_MESSAGE:
@@ -188,10 +271,10 @@ char *ufraw_message(int code, const char *format, ...)
             g_free(message);
             return NULL;
         case UFRAW_REPORT:
-            ufraw_messenger(errorBuffer, parentWindow);
+            context_messenger(context, context->errorBuffer, parentWindow);
             return NULL;
         default:
-            ufraw_messenger(message, parentWindow);
+            context_messenger(context, message, parentWindow);
             g_free(message);
             return NULL;
     }
@@ -0,0 +1,310 @@
+/*
+ * UFRaw - Unidentified Flying Raw converter for digital camera images
+ *
+ * ufraw_timings.c - Per stage timing, memory and trace instrumentation
+ * Copyright 2026 by the UFRaw developers
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include "ufraw.h"
+#include <string.h>
+#include <time.h>
+
+/*
+ * The stages are bracketed by ufraw_timing_begin() and ufraw_timing_end()
+ * in the thread which runs the conversion. The measurements are kept in
+ * the ufraw_context of that thread, so nothing is recorded unless the
+ * caller asked for timings (ufraw-batch --timings).
+ *
+ * Wall time is measured per stage. CPU time is the CPU time of the whole
+ * process during the stage, which includes the OpenMP workers, but also
+ * any other conversion running at the same time.
+ *
+ * Independently of the timings, the stages and the blocks of work done by
+ * the OpenMP workers can be recorded as trace events of every thread, see
+ * ufraw_trace_open(). The trace is written in the Chrome trace event JSON
+ * format, which can be viewed in chrome://tracing or Perfetto.
+ */
+
+typedef struct {
+    double wall, cpu;
+    double startWall, startCpu;
+    gsize peakBytes;
+    int calls;
+} ufraw_stage_timing;
+
+struct _ufraw_timings {
+    GTimer *timer;
+    ufraw_stage_timing stage[TIMING_STAGES];
+};
+
+static const char *timingNames[TIMING_STAGES] = {
+    "open", "load_raw", "scale_raw", "hotpixels", "denoise",
+    "finalize_raw", "despeckle", "tca", "interpolate", "smooth",
+    "resize", "transform", "prepare", "develop", "encode"
+};
+
+ufraw_timings *ufraw_timings_new(void)
+{
+    ufraw_timings *timings = g_new0(ufraw_timings, 1);
+    timings->timer = g_timer_new();
+    return timings;
+}
+
+void ufraw_timings_free(ufraw_timings *timings)
+{
+    if (timings == NULL) return;
+    g_timer_destroy(timings->timer);
+    g_free(timings);
+}
+
+/* Trace state. traceTimer is only set while tracing. */
+static GTimer *volatile traceTimer;
+static GString *traceEvents;
+static char *traceFilename;
+static int traceThreads;
+G_LOCK_DEFINE_STATIC(trace);
+
+typedef struct {
+    int tid;
+    gboolean named;
+    long long stageStart[TIMING_STAGES];
+} trace_thread;
+
+#if GLIB_CHECK_VERSION(2,32,0)
+static GPrivate current_trace_thread = G_PRIVATE_INIT(g_free);
+#else
+static GStaticPrivate current_trace_thread = G_STATIC_PRIVATE_INIT;
+#endif
+
+static const char *traceCategories[] = {
+    "stage", "wavelet_denoise", "despeckle", "interpolate", "render",
+    "load", "save"
+};
+
+static void trace_append(const char *event)
+{
+    if (traceEvents->len > 0)
+        g_string_append(traceEvents, ",\n");
+    g_string_append(traceEvents, event);
+}
+
+/* Return the trace state of the calling thread, giving it a thread id
+ * on first use. */
+static trace_thread *trace_thread_current(void)
+{
+#if GLIB_CHECK_VERSION(2,32,0)
+    trace_thread *thread = g_private_get(&current_trace_thread);
+#else
+    trace_thread *thread = g_static_private_get(&current_trace_thread);
+#endif
+    if (thread != NULL)
+        return thread;
+    thread = g_new0(trace_thread, 1);
+    G_LOCK(trace);
+    thread->tid = ++traceThreads;
+    G_UNLOCK(trace);
+#if GLIB_CHECK_VERSION(2,32,0)
+    g_private_set(&current_trace_thread, thread);
+#else
+    g_static_private_set(&current_trace_thread, thread, g_free);
+#endif
+    return thread;
+}
+
+/* Start recording trace events, which are written to filename by
+ * ufraw_trace_close(). */
+void ufraw_trace_open(const char *filename)
+{
+    traceEvents = g_string_new("");
+    traceFilename = g_strdup(filename);
+    traceTimer = g_timer_new();
+}
+
+/* Write the recorded trace events and stop tracing. All traced work must
+ * be finished. Returns FALSE if the file could not be written. */
+gboolean ufraw_trace_close(GError **error)
+{
+    if (traceTimer == NULL)
+        return TRUE;
+    G_LOCK(trace);
+    GTimer *timer = traceTimer;
+    GString *events = traceEvents;
+    traceTimer = NULL;
+    traceEvents = NULL;
+    G_UNLOCK(trace);
+    g_timer_destroy(timer);
+    char *text = g_strdup_printf("{\"traceEvents\":[\n%s\n],"
+                                 "\"displayTimeUnit\":\"ms\"}\n",
+                                 events->str);
+    gboolean status = g_file_set_contents(traceFilename, text, -1, error);
+    g_free(text);
+    g_string_free(events, TRUE);
+    g_free(traceFilename);
+    traceFilename = NULL;
+    return status;
+}
+
+/* Name the calling thread in the trace, only the first name is kept */
+void ufraw_trace_thread_name(const char *name)
+{
+    if (traceTimer == NULL)
+        return;
+    trace_thread *thread = trace_thread_current();
+    if (thread->named)
+        return;
+    thread->named = TRUE;
+    char *event = g_strdup_printf("{\"name\":\"thread_name\",\"ph\":\"M\","
+                                  "\"pid\":1,\"tid\":%d,"
+                                  "\"args\":{\"name\":\"%s\"}}",
+                                  thread->tid, name);
+    G_LOCK(trace);
+    if (traceEvents != NULL)
+        trace_append(event);
+    G_UNLOCK(trace);
+    g_free(event);
+}
+
+long long ufraw_trace_begin(void)
+{
+    GTimer *timer = traceTimer;
+    if (timer == NULL)
+        return -1;
+    return (long long)(g_timer_elapsed(timer, NULL) * 1000000);
+}
+
+void ufraw_trace_end(long long start, int what, const char *name, int index)
+{
+    GTimer *timer = traceTimer;
+    if (start < 0 || timer == NULL)
+        return;
+    long long end = (long long)(g_timer_elapsed(timer, NULL) * 1000000);
+    trace_thread *thread = trace_thread_current();
+    char args[max_name] = "";
+    if (index >= 0)
+        g_snprintf(args, max_name, ",\"args\":{\"index\":%d}", index);
+    char *event = g_strdup_printf("{\"name\":\"%s\",\"cat\":\"%s\","
+                                  "\"ph\":\"X\",\"ts\":%lld,\"dur\":%lld,"
+                                  "\"pid\":1,\"tid\":%d%s}", name,
+                                  traceCategories[what], start, end - start,
+                                  thread->tid, args);
+    G_LOCK(trace);
+    /* The timer may have been stopped meanwhile */
+    if (traceEvents != NULL)
+        trace_append(event);
+    G_UNLOCK(trace);
+    g_free(event);
+}
+
+static ufraw_timings *timings_current(void)
+{
+    ufraw_context *context = ufraw_context_get();
+    return context != NULL ? context->timings : NULL;
+}
+
+static double cpu_seconds(void)
+{
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+void ufraw_timing_begin(int stage)
+{
+    if (traceTimer != NULL)
+        trace_thread_current()->stageStart[stage] = ufraw_trace_begin();
+    ufraw_timings *timings = timings_current();
+    if (timings == NULL) return;
+    ufraw_stage_timing *t = &timings->stage[stage];
+    t->startWall = g_timer_elapsed(timings->timer, NULL);
+    t->startCpu = cpu_seconds();
+}
+
+void ufraw_timing_end(int stage, size_t bytes)
+{
+    if (traceTimer != NULL)
+        ufraw_trace_end(trace_thread_current()->stageStart[stage], 0,
+                        timingNames[stage], -1);
+    ufraw_timings *timings = timings_current();
+    if (timings == NULL) return;
+    ufraw_stage_timing *t = &timings->stage[stage];
+    t->wall += g_timer_elapsed(timings->timer, NULL) - t->startWall;
+    t->cpu += cpu_seconds() - t->startCpu;
+    t->peakBytes = MAX(t->peakBytes, bytes);
+    t->calls++;
+}
+
+/* Return the wall time in seconds spent so far in stage */
+double ufraw_timings_wall(ufraw_timings *timings, int stage)
+{
+    return timings->stage[stage].wall;
+}
+
+static void json_append_string(GString *str, const char *s)
+{
+    g_string_append_c(str, '"');
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            g_string_append_printf(str, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            g_string_append_printf(str, "\\u%04x", *s);
+        else
+            g_string_append_c(str, *s);
+    }
+    g_string_append_c(str, '"');
+}
+
+/* Format the timings of filename as a table, or as a single line of JSON.
+ * The returned string should be freed with g_free(). */
+char *ufraw_timings_format(ufraw_timings *timings, const char *filename,
+                           gboolean json)
+{
+    GString *str = g_string_new("");
+    double wall = 0, cpu = 0;
+    gsize peakBytes = 0;
+    gboolean first = TRUE;
+    int i;
+
+    char *locale = uf_set_locale_C();
+    if (json) {
+        g_string_append(str, "{\"file\":");
+        json_append_string(str, filename);
+        g_string_append(str, ",\"stages\":[");
+    } else {
+        g_string_append_printf(str, "Timings for %s\n", filename);
+        g_string_append_printf(str, "%-14s %10s %10s %10s %6s\n", "stage",
+                               "wall ms", "cpu ms", "peak MiB", "calls");
+    }
+    for (i = 0; i < TIMING_STAGES; i++) {
+        ufraw_stage_timing *t = &timings->stage[i];
+        if (t->calls == 0) continue;
+        if (json)
+            g_string_append_printf(str, "%s{\"stage\":\"%s\",\"wall_ms\":%.3f,"
+                                   "\"cpu_ms\":%.3f,\"peak_bytes\":%lu,"
+                                   "\"calls\":%d}", first ? "" : ",",
+                                   timingNames[i], t->wall * 1000,
+                                   t->cpu * 1000, (unsigned long)t->peakBytes,
+                                   t->calls);
+        else
+            g_string_append_printf(str, "%-14s %10.1f %10.1f %10.1f %6d\n",
+                                   timingNames[i], t->wall * 1000,
+                                   t->cpu * 1000, t->peakBytes / 1048576.0,
+                                   t->calls);
+        first = FALSE;
+        wall += t->wall;
+        cpu += t->cpu;
+        peakBytes = MAX(peakBytes, t->peakBytes);
+    }
+    if (json)
+        g_string_append_printf(str, "],\"wall_ms\":%.3f,\"cpu_ms\":%.3f,"
+                               "\"peak_bytes\":%lu}", wall * 1000, cpu * 1000,
+                               (unsigned long)peakBytes);
+    else
+        g_string_append_printf(str, "%-14s %10.1f %10.1f %10.1f\n", "total",
+                               wall * 1000, cpu * 1000,
+                               peakBytes / 1048576.0);
+    uf_reset_locale(locale);
+    return g_string_free(str, FALSE);
+}
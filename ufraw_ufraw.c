@@ -30,7 +30,7 @@
 #include <bzlib.h>
 #endif
 
-void (*ufraw_progress)(int what, int ticks) = NULL;
+ufraw_progress_func ufraw_progress = NULL;
 
 #ifdef HAVE_LENSFUN
 #define UF_LF_TRANSFORM ( \
@@ -53,98 +53,86 @@ static void ufraw_convert_prepare_first_buffer(ufraw_data *uf,
 static void ufraw_convert_prepare_transform_buffer(ufraw_data *uf,
         ufraw_image_data *img, int width, int height);
 static void ufraw_convert_reverse_wb(ufraw_data *uf, UFRawPhase phase);
-static void ufraw_convert_import_buffer(ufraw_data *uf, UFRawPhase phase,
-                                        dcraw_image_data *dcimg);
 
-static int make_temporary(char *basefilename, char **tmpfilename)
-{
-    int fd;
-    char *basename = g_path_get_basename(basefilename);
-    char *template = g_strconcat(basename, ".tmp.XXXXXX", NULL);
-    fd = g_file_open_tmp(template, tmpfilename, NULL);
-    g_free(template);
-    g_free(basename);
-    return fd;
-}
-
-static ssize_t writeall(int fd, const char *buf, ssize_t size)
-{
-    ssize_t written;
-    ssize_t wr;
-    for (written = 0; size > 0; size -= wr, written += wr, buf += wr)
-        if ((wr = write(fd, buf, size)) < 0)
-            break;
-    return written;
-}
-
-static char *decompress_gz(char *origfilename)
+/* Inflate a compressed raw file into memory. The returned buffer is
+ * read by dcraw through dcraw_open_buffer() and by Exiv2. */
+static gchar *decompress_gz(char *origfilename, gsize *len)
 {
 #ifdef HAVE_LIBZ
-    char *tempfilename;
-    int tmpfd;
     gzFile gzfile;
-    char buf[8192];
-    ssize_t size;
-    if ((tmpfd = make_temporary(origfilename, &tempfilename)) == -1)
-        return NULL;
+    gchar *buf = NULL;
+    gsize alloc = 1 << 20, used = 0;
+    int size;
+
     char *filename = uf_win32_locale_filename_from_utf8(origfilename);
     gzfile = gzopen(filename, "rb");
     uf_win32_locale_filename_free(filename);
-    if (gzfile != NULL) {
-        while ((size = gzread(gzfile, buf, sizeof buf)) > 0) {
-            if (writeall(tmpfd, buf, size) != size)
-                break;
+    if (gzfile == NULL)
+        return NULL;
+    do {
+        if (used == alloc || buf == NULL) {
+            alloc = buf == NULL ? alloc : 2 * alloc;
+            buf = g_realloc(buf, alloc);
         }
-        gzclose(gzfile);
-        if (size == 0)
-            if (close(tmpfd) == 0)
-                return tempfilename;
-    }
-    close(tmpfd);
-    g_unlink(tempfilename);
-    g_free(tempfilename);
-    return NULL;
+        size = gzread(gzfile, buf + used, MIN(alloc - used, G_MAXINT));
+        if (size > 0)
+            used += size;
+    } while (size > 0);
+    gzclose(gzfile);
+    if (size < 0) {
+        g_free(buf);
+        return NULL;
+    }
+    *len = used;
+    return buf;
 #else
     (void)origfilename;
+    (void)len;
     ufraw_message(UFRAW_SET_ERROR,
                   "Cannot open gzip compressed images.\n");
     return NULL;
 #endif
 }
 
-static char *decompress_bz2(char *origfilename)
+static gchar *decompress_bz2(char *origfilename, gsize *len)
 {
 #ifdef HAVE_LIBBZ2
-    char *tempfilename;
-    int tmpfd;
     FILE *compfile;
     BZFILE *bzfile;
-    int bzerror;
-    char buf[8192];
-    ssize_t size;
+    int bzerror, status;
+    gchar *buf = NULL;
+    gsize alloc = 1 << 20, used = 0;
+    int size;
 
-    if ((tmpfd = make_temporary(origfilename, &tempfilename)) == -1)
-        return NULL;
     compfile = g_fopen(origfilename, "rb");
-    if (compfile != NULL) {
-        if ((bzfile = BZ2_bzReadOpen(&bzerror, compfile, 0, 0, 0, 0)) != 0) {
-            while ((size = BZ2_bzRead(&bzerror, bzfile, buf, sizeof buf)) > 0)
-                if (writeall(tmpfd, buf, size) != size)
-                    break;
-            BZ2_bzReadClose(&bzerror, bzfile);
-            fclose(compfile);
-            if (size == 0) {
-                close(tmpfd);
-                return tempfilename;
-            }
+    if (compfile == NULL)
+        return NULL;
+    if ((bzfile = BZ2_bzReadOpen(&bzerror, compfile, 0, 0, 0, 0)) == NULL) {
+        fclose(compfile);
+        return NULL;
+    }
+    do {
+        if (used == alloc || buf == NULL) {
+            alloc = buf == NULL ? alloc : 2 * alloc;
+            buf = g_realloc(buf, alloc);
         }
+        size = BZ2_bzRead(&bzerror, bzfile, buf + used,
+                          MIN(alloc - used, G_MAXINT));
+        if (size > 0)
+            used += size;
+    } while (bzerror == BZ_OK);
+    status = bzerror;
+    BZ2_bzReadClose(&bzerror, bzfile);
+    fclose(compfile);
+    if (status != BZ_STREAM_END) {
+        g_free(buf);
+        return NULL;
     }
-    close(tmpfd);
-    g_unlink(tempfilename);
-    g_free(tempfilename);
-    return NULL;
+    *len = used;
+    return buf;
 #else
     (void)origfilename;
+    (void)len;
     ufraw_message(UFRAW_SET_ERROR,
                   "Cannot open bzip2 compressed images.\n");
     return NULL;
@@ -159,9 +147,9 @@ ufraw_data *ufraw_open(char *filename)
     ufraw_message(UFRAW_CLEAN, NULL);
     conf_data *conf = NULL;
     char *fname, *hostname;
-    char *origfilename;
     gchar *unzippedBuf = NULL;
     gsize unzippedBufLen = 0;
+    gboolean compressed = FALSE;
 
     fname = g_filename_from_uri(filename, &hostname, NULL);
     if (fname != NULL) {
@@ -209,24 +197,25 @@ ufraw_data *ufraw_open(char *filename)
 
         filename = conf->inputFilename;
     }
-    origfilename = filename;
-    if (!strcasecmp(filename + strlen(filename) - 3, ".gz"))
-        filename = decompress_gz(filename);
-    else if (!strcasecmp(filename + strlen(filename) - 4, ".bz2"))
-        filename = decompress_bz2(filename);
-    if (filename == 0) {
+    if (!strcasecmp(filename + strlen(filename) - 3, ".gz")) {
+        unzippedBuf = decompress_gz(filename, &unzippedBufLen);
+        compressed = TRUE;
+    } else if (!strcasecmp(filename + strlen(filename) - 4, ".bz2")) {
+        unzippedBuf = decompress_bz2(filename, &unzippedBufLen);
+        compressed = TRUE;
+    }
+    if (compressed && unzippedBuf == NULL) {
         ufraw_message(UFRAW_SET_ERROR,
-                      "Error creating temporary file for compressed data.");
+                      "Error reading compressed data from %s.", filename);
         return NULL;
     }
     raw = g_new(dcraw_data, 1);
-    status = dcraw_open(raw, filename);
-    if (filename != origfilename) {
-        g_file_get_contents(filename, &unzippedBuf, &unzippedBufLen, NULL);
-        g_unlink(filename);
-        g_free(filename);
-        filename = origfilename;
-    }
+    ufraw_timing_begin(TIMING_OPEN);
+    if (unzippedBuf != NULL)
+        status = dcraw_open_buffer(raw, filename, unzippedBuf, unzippedBufLen);
+    else
+        status = dcraw_open(raw, filename);
+    ufraw_timing_end(TIMING_OPEN, unzippedBufLen);
     if (status != DCRAW_SUCCESS) {
         /* Hold the message without displaying it */
         ufraw_message(UFRAW_SET_WARNING, raw->message);
@@ -237,6 +226,7 @@ ufraw_data *ufraw_open(char *filename)
         }
     }
     uf = g_new0(ufraw_data, 1);
+    uf->context = ufraw_context_get();
     ufraw_message_init(uf);
     uf->rgbMax = 0; // This indicates that the raw file was not loaded yet.
     uf->unzippedBuf = unzippedBuf;
@@ -412,7 +402,40 @@ void ufraw_get_scaled_crop(ufraw_data *uf, UFRectangle *crop)
     crop->height = y2 - crop->y;
 }
 
+static int ufraw_do_config(ufraw_data *uf, conf_data *rc, conf_data *conf,
+                           conf_data *cmd);
+static int ufraw_do_load_raw(ufraw_data *uf);
+static int ufraw_do_convert_image(ufraw_data *uf);
+
+/* Run the public entry points in the context uf was opened in, so that
+ * its messages and progress do not mix with other conversions. */
 int ufraw_config(ufraw_data *uf, conf_data *rc, conf_data *conf, conf_data *cmd)
+{
+    g_assert(uf != NULL);
+    ufraw_context *prev = ufraw_context_set(uf->context);
+    int status = ufraw_do_config(uf, rc, conf, cmd);
+    ufraw_context_set(prev);
+    return status;
+}
+
+int ufraw_load_raw(ufraw_data *uf)
+{
+    ufraw_context *prev = ufraw_context_set(uf->context);
+    int status = ufraw_do_load_raw(uf);
+    ufraw_context_set(prev);
+    return status;
+}
+
+int ufraw_convert_image(ufraw_data *uf)
+{
+    ufraw_context *prev = ufraw_context_set(uf->context);
+    int status = ufraw_do_convert_image(uf);
+    ufraw_context_set(prev);
+    return status;
+}
+
+static int ufraw_do_config(ufraw_data *uf, conf_data *rc, conf_data *conf,
+                           conf_data *cmd)
 {
     int status;
 
@@ -511,7 +534,9 @@ int ufraw_config(ufraw_data *uf, conf_data *rc, conf_data *conf, conf_data *cmd)
         g_snprintf(uf->conf->inputURI, max_path, "file://%s",
                    uf->conf->inputFilename);
         struct stat s;
-        fstat(fileno(raw->ifp), &s);
+        /* raw->ifp has no file descriptor if it was decompressed. */
+        if (fstat(fileno(raw->ifp), &s) != 0 && g_stat(uf->filename, &s) != 0)
+            s.st_mtime = 0;
         g_snprintf(uf->conf->inputModTime, max_name, "%d", (int)s.st_mtime);
     }
     if (strlen(uf->conf->outputFilename) == 0) {
@@ -527,8 +552,6 @@ int ufraw_config(ufraw_data *uf, conf_data *rc, conf_data *conf, conf_data *cmd)
         g_strlcpy(uf->conf->outputFilename, filename, max_path);
         g_free(filename);
     }
-    g_free(uf->unzippedBuf);
-    uf->unzippedBuf = NULL;
     /* Set the EXIF data */
 #ifdef __MINGW32__
     /* MinG32 does not have ctime_r(). */
@@ -626,8 +649,8 @@ int ufraw_config(ufraw_data *uf, conf_data *rc, conf_data *conf, conf_data *cmd)
  * which forget to check rgbMax or assume a particular value. */
 static unsigned ufraw_scale_raw(dcraw_data *raw)
 {
-    guint16 *p, *end;
-    int scale;
+    guint16 *p;
+    int scale, i, count;
 
     scale = 0;
     while ((raw->rgbMax << 1) <= 0xffff) {
@@ -635,20 +658,22 @@ static unsigned ufraw_scale_raw(dcraw_data *raw)
         ++scale;
     }
     if (scale) {
-        end = (guint16 *)(raw->raw.image + raw->raw.width * raw->raw.height);
-        /* OpenMP overhead appears to be too large in this case */
+        p = (guint16 *)raw->raw.image;
+        count = raw->raw.width * raw->raw.height * 4;
         int max = 0x10000 >> scale;
-        for (p = (guint16 *)raw->raw.image; p < end; ++p)
-            if (*p < max)
-                *p <<= scale;
-            else
-                *p = 0xffff;
+        /* Branch free, so that it vectorizes. The OpenMP overhead only
+         * pays off because the raw images are large nowadays. */
+#ifdef _OPENMP
+        #pragma omp parallel for schedule(static) default(shared) private(i)
+#endif
+        for (i = 0; i < count; ++i)
+            p[i] = p[i] < max ? p[i] << scale : 0xffff;
         raw->black <<= scale;
     }
     return 1 << scale;
 }
 
-int ufraw_load_raw(ufraw_data *uf)
+static int ufraw_do_load_raw(ufraw_data *uf)
 {
     int status;
     dcraw_data *raw = uf->raw;
@@ -663,13 +688,20 @@ int ufraw_load_raw(ufraw_data *uf)
         uf->thumb.width = thumb.width;
         return ufraw_read_embedded(uf);
     }
-    if ((status = dcraw_load_raw(raw)) != DCRAW_SUCCESS) {
+    ufraw_timing_begin(TIMING_LOAD_RAW);
+    status = dcraw_load_raw(raw);
+    ufraw_timing_end(TIMING_LOAD_RAW, (size_t)raw->raw.height *
+                     raw->raw.width * sizeof(dcraw_image_type));
+    if (status != DCRAW_SUCCESS) {
         ufraw_message(UFRAW_SET_LOG, raw->message);
         ufraw_message(status, raw->message);
         if (status != DCRAW_WARNING) return status;
     }
     uf->HaveFilters = raw->filters != 0;
+    ufraw_timing_begin(TIMING_SCALE_RAW);
     uf->raw_multiplier = ufraw_scale_raw(raw);
+    ufraw_timing_end(TIMING_SCALE_RAW, (size_t)raw->raw.height *
+                     raw->raw.width * sizeof(dcraw_image_type));
     /* Canon EOS cameras require special exposure normalization */
     if (strcasecmp(uf->conf->make, "Canon") == 0 &&
             strncmp(uf->conf->model, "EOS", 3) == 0) {
@@ -833,10 +865,12 @@ void ufraw_developer_prepare(ufraw_data *uf, DeveloperMode mode)
     }
 }
 
-int ufraw_convert_image(ufraw_data *uf)
+static int ufraw_do_convert_image(ufraw_data *uf)
 {
     uf->mark_hotpixels = FALSE;
+    ufraw_timing_begin(TIMING_PREPARE);
     ufraw_developer_prepare(uf, file_developer);
+    ufraw_timing_end(TIMING_PREPARE, 0);
     ufraw_convert_image_raw(uf, ufraw_raw_phase);
 
     ufraw_image_data *img = &uf->Images[ufraw_first_phase];
@@ -844,6 +878,7 @@ int ufraw_convert_image(ufraw_data *uf)
     ufraw_convert_image_first(uf, ufraw_first_phase);
 
     UFRectangle area = { 0, 0, img->width, img->height };
+    ufraw_timing_begin(TIMING_TRANSFORM);
     // prepare_transform has to be called before applying vignetting
     ufraw_image_data *img2 = &uf->Images[ufraw_transform_phase];
     ufraw_convert_prepare_transform_buffer(uf, img2, img->width, img->height);
@@ -852,15 +887,18 @@ int ufraw_convert_image(ufraw_data *uf)
         ufraw_convert_image_vignetting(uf, img, &area);
     }
 #endif
+    size_t size = (size_t)img->height * img->rowstride;
     if (img2->buffer != NULL) {
         area.width = img2->width;
         area.height = img2->height;
         /* Apply distortion, geometry and rotation */
         ufraw_convert_image_transform(uf, img, img2, &area);
+        size += (size_t)img2->height * img2->rowstride;
         g_free(img->buffer);
         *img = *img2;
         img2->buffer = NULL;
     }
+    ufraw_timing_end(TIMING_TRANSFORM, size);
     if (uf->conf->autoCrop && !uf->LoadingID) {
         ufraw_get_image_dimensions(uf);
         uf->conf->CropX1 = (uf->rotatedWidth - uf->autoCropWidth) / 2;
@@ -1025,70 +1063,136 @@ static void ufraw_convert_image_transform(ufraw_data *uf, ufraw_image_data *img,
  * next (unprocessed) row and whether or not pixels are marked may make a
  * difference for the hot pixel count.
  *
- * Cleanup issue:
- * -	change prototype to void x(ufraw_data *uf, UFRawPhase phase)
- * -	use ufraw_image_format()
- * -	use uf->rgbMax (check, must be about 64k)
+ * The row is shaved in place, above and below are the rows next to it.
+ * Returns the number of hot pixels.
  */
-static void ufraw_shave_hotpixels(ufraw_data *uf, dcraw_image_type *img,
-                                  int width, int height, int colors,
-                                  unsigned rgbMax)
+static int ufraw_shave_hotpixels_row(ufraw_data *uf, dcraw_image_type *p,
+                                     const dcraw_image_type *above,
+                                     const dcraw_image_type *below,
+                                     int width, int colors, unsigned delta)
 {
-    int w, h, c, i, count;
-    unsigned delta, t, v, hi;
-    dcraw_image_type *p;
+    int w, c, i, count;
+    unsigned t, v, hi;
 
-    uf->hotpixels = 0;
-    if (uf->conf->hotpixel <= 0.0)
-        return;
-    delta = rgbMax / (uf->conf->hotpixel + 1.0);
+    count = 0;
+    for (w = 1; w < width - 1; ++w) {
+        for (c = 0; c < colors; ++c) {
+            t = p[w][c];
+            if (t <= delta)
+                continue;
+            t -= delta;
+            v = p[w - 1][c];
+            if (v > t)
+                continue;
+            hi = v;
+            v = p[w + 1][c];
+            if (v > t)
+                continue;
+            if (v > hi)
+                hi = v;
+            v = above[w][c];
+            if (v > t)
+                continue;
+            if (v > hi)
+                hi = v;
+            v = below[w][c];
+            if (v > t)
+                continue;
+            if (v > hi)
+                hi = v;
+            /* mark the pixel using the original hot value */
+            if (uf->mark_hotpixels) {
+                for (i = -10; i >= -20 && w + i >= 0; --i)
+                    memcpy(p[w + i], p[w], sizeof(p[w]));
+                for (i = 10; i <= 20 && w + i < width; ++i)
+                    memcpy(p[w + i], p[w], sizeof(p[w]));
+            }
+            p[w][c] = hi;
+            ++count;
+        }
+    }
+    return count;
+}
+
+/* Bytes of the phase buffer processed at a time by ufraw_convert_import_raw(),
+ * the band and the raw rows it is copied from should stay in the L2 cache */
+#define IMPORT_BAND_BYTES (256 * 1024)
+
+/*
+ * Copy the raw image into the buffer of the phase, shave the hot pixels and,
+ * if finalize is set, do the black level adjustment, dark frame subtraction
+ * and white balance of dcraw_finalize_raw(). Instead of a pass over the
+ * whole image for each step, all steps are done on a band of rows while it
+ * is still in the cache.
+ *
+ * Each band is shaved independently: its first row is compared with the
+ * unprocessed row above it. The dark frame subtraction reads the rows
+ * around each pixel, which may belong to the neighbouring bands, so with a
+ * dark frame the image is finalized only after all bands are imported.
+ *
+ * On return raw->raw.image points to the buffer of the phase.
+ */
+static void ufraw_convert_import_raw(ufraw_data *uf, UFRawPhase phase,
+                                     dcraw_data *dark, gboolean finalize)
+{
+    ufraw_image_data *img = &uf->Images[phase];
+    dcraw_data *raw = uf->raw;
+    const dcraw_image_type *src = raw->raw.image;
+    dcraw_image_type *dst;
+    int width = raw->raw.width, height = raw->raw.height;
+    int colors = raw->raw.colors;
+    int band, bands, b, count;
+    unsigned delta;
+
+    /* Reusing the buffer saves faulting in its pages again */
+    if (img->buffer == NULL || img->height != height || img->width != width ||
+            img->depth != sizeof(dcraw_image_type)) {
+        img->height = height;
+        img->width = width;
+        img->depth = sizeof(dcraw_image_type);
+        img->rowstride = img->width * img->depth;
+        g_free(img->buffer);
+        img->buffer = g_malloc((size_t)img->height * img->rowstride);
+    }
+    dst = (dcraw_image_type *)img->buffer;
+    raw->raw.image = dst;
+
+    delta = 0;
+    if (uf->conf->hotpixel > 0.0)
+        delta = raw->rgbMax / (uf->conf->hotpixel + 1.0);
+    /* See dcraw_finalize_raw() */
+    if (finalize && raw->colors == 3)
+        uf->developer->rgbWB[3] = uf->developer->rgbWB[1];
+    band = MAX(IMPORT_BAND_BYTES / MAX(img->rowstride, 1), 2);
+    bands = (height + band - 1) / band;
     count = 0;
 #ifdef _OPENMP
-    #pragma omp parallel for schedule(static) \
-    shared(uf,img,width,height,colors,rgbMax,delta) \
-reduction(+:count) \
-    private(h,p,w,c,t,v,hi,i)
+    #pragma omp parallel for schedule(dynamic) default(shared) \
+    private(b) reduction(+:count)
 #endif
-    for (h = 1; h < height - 1; ++h) {
-        p = img + 1 + h * width;
-        for (w = 1; w < width - 1; ++w, ++p) {
-            for (c = 0; c < colors; ++c) {
-                t = p[0][c];
-                if (t <= delta)
-                    continue;
-                t -= delta;
-                v = p[-1][c];
-                if (v > t)
-                    continue;
-                hi = v;
-                v = p[1][c];
-                if (v > t)
-                    continue;
-                if (v > hi)
-                    hi = v;
-                v = p[-width][c];
-                if (v > t)
-                    continue;
-                if (v > hi)
-                    hi = v;
-                v = p[width][c];
-                if (v > t)
-                    continue;
-                if (v > hi)
-                    hi = v;
-                /* mark the pixel using the original hot value */
-                if (uf->mark_hotpixels) {
-                    for (i = -10; i >= -20 && w + i >= 0; --i)
-                        memcpy(p[i], p[0], sizeof(p[i]));
-                    for (i = 10; i <= 20 && w + i < width; ++i)
-                        memcpy(p[i], p[0], sizeof(p[i]));
-                }
-                p[0][c] = hi;
-                ++count;
+    for (b = 0; b < bands; b++) {
+        int first = b * band;
+        int last = MIN(first + band, height);
+        int h;
+        memcpy(dst + (size_t)first * width, src + (size_t)first * width,
+               (size_t)(last - first) * img->rowstride);
+        if (delta > 0) {
+            for (h = MAX(first, 1); h < MIN(last, height - 1); h++) {
+                const dcraw_image_type *above = h == first ?
+                                                src + (size_t)(h - 1) * width :
+                                                dst + (size_t)(h - 1) * width;
+                count += ufraw_shave_hotpixels_row(uf, dst + (size_t)h * width,
+                                                   above, src + (size_t)(h + 1) * width,
+                                                   width, colors, delta);
             }
         }
+        if (finalize && dark == NULL)
+            dcraw_finalize_raw_rows(raw, dark, uf->developer->rgbWB,
+                                    first, last);
     }
     uf->hotpixels = count;
+    if (finalize && dark != NULL)
+        dcraw_finalize_raw(raw, dark, uf->developer->rgbWB);
 }
 
 static void ufraw_despeckle_line(guint16 *base, int step, int size, int window,
@@ -1165,6 +1269,8 @@ void ufraw_despeckle(ufraw_data *uf, UFRawPhase phase)
         if (passes[c] > maxpass)
             maxpass = passes[c];
     }
+    if (maxpass > 0)
+        ufraw_timing_begin(TIMING_DESPECKLE);
     progress(PROGRESS_DESPECKLE, -maxpass * colors);
     for (pass = maxpass - 1; pass >= 0; --pass) {
         for (c = 0; c < colors; ++c) {
@@ -1189,6 +1295,8 @@ void ufraw_despeckle(ufraw_data *uf, UFRawPhase phase)
             }
         }
     }
+    if (maxpass > 0)
+        ufraw_timing_end(TIMING_DESPECKLE, (size_t)img->height * img->rowstride);
 }
 
 static gboolean ufraw_despeckle_active(ufraw_data *uf)
@@ -1241,12 +1349,14 @@ static void ufraw_convertshrink(ufraw_data *uf, dcraw_image_data *final)
     dcraw_data *raw = uf->raw;
     int scale = ufraw_calculate_scale(uf);
 
-    if (uf->HaveFilters && scale == 1)
+    if (uf->HaveFilters && scale == 1) {
         dcraw_finalize_interpolate(final, raw, uf->conf->interpolation,
                                    uf->conf->smoothing);
-    else
+        ufraw_timing_begin(TIMING_RESIZE);
+    } else {
+        ufraw_timing_begin(TIMING_RESIZE);
         dcraw_finalize_shrink(final, raw, scale);
-
+    }
     dcraw_image_stretch(final, raw->pixel_aspect);
     if (uf->conf->size == 0 && uf->conf->shrink > 1) {
         dcraw_image_resize(final,
@@ -1274,39 +1384,52 @@ static void ufraw_convertshrink(ufraw_data *uf, dcraw_image_data *final)
             dcraw_image_resize(final, uf->conf->size * finalSize / cropSize);
         }
     }
+    ufraw_timing_end(TIMING_RESIZE, (size_t)final->height * final->width *
+                     sizeof(dcraw_image_type));
 }
 
 /*
- * Interface of ufraw_shave_hotpixels(), dcraw_finalize_raw() and preferably
- * dcraw_wavelet_denoise() too should change to accept a phase argument and
- * no longer require type casts.
+ * Interface of dcraw_finalize_raw() and preferably dcraw_wavelet_denoise()
+ * too should change to accept a phase argument and no longer require type
+ * casts.
  */
 static void ufraw_convert_image_raw(ufraw_data *uf, UFRawPhase phase)
 {
     ufraw_image_data *img = &uf->Images[phase];
     dcraw_data *dark = uf->conf->darkframe ? uf->conf->darkframe->raw : NULL;
     dcraw_data *raw = uf->raw;
-    dcraw_image_type *rawimage;
+    dcraw_image_type *rawimage = raw->raw.image;
+    /* The threshold is scaled for compatibility */
+    float threshold = uf->IsXTrans ? 0 :
+                      uf->conf->threshold * sqrt(uf->raw_multiplier);
 
-    ufraw_convert_import_buffer(uf, phase, &raw->raw);
+    /* Without denoising the raw image is finalized while it is imported */
+    int stage = threshold ? TIMING_HOTPIXELS : TIMING_FINALIZE_RAW;
+    ufraw_timing_begin(stage);
+    ufraw_convert_import_raw(uf, phase, dark, !threshold);
     img->rgbg = raw->raw.colors == 4;
-    ufraw_shave_hotpixels(uf, (dcraw_image_type *)(img->buffer), img->width,
-                          img->height, raw->raw.colors, raw->rgbMax);
-    rawimage = raw->raw.image;
-    raw->raw.image = (dcraw_image_type *)img->buffer;
-    /* The threshold is scaled for compatibility */
-    if (!uf->IsXTrans) dcraw_wavelet_denoise(raw, uf->conf->threshold * sqrt(uf->raw_multiplier));
-    dcraw_finalize_raw(raw, dark, uf->developer->rgbWB);
+    size_t size = (size_t)img->height * img->rowstride;
+    ufraw_timing_end(stage, 2 * size);
+    if (threshold) {
+        ufraw_timing_begin(TIMING_DENOISE);
+        dcraw_wavelet_denoise(raw, threshold);
+        ufraw_timing_end(TIMING_DENOISE, size);
+        ufraw_timing_begin(TIMING_FINALIZE_RAW);
+        dcraw_finalize_raw(raw, dark, uf->developer->rgbWB);
+        ufraw_timing_end(TIMING_FINALIZE_RAW, size);
+    }
     raw->raw.image = rawimage;
     ufraw_despeckle(uf, phase);
 #ifdef HAVE_LENSFUN
     ufraw_prepare_tca(uf);
     if (uf->TCAmodifier != NULL) {
+        ufraw_timing_begin(TIMING_TCA);
         ufraw_image_data inImg = *img;
         img->buffer = g_malloc(img->height * img->rowstride);
         UFRectangle area = {0, 0, img->width, img->height };
         ufraw_convert_image_tca(uf, &inImg, img, &area);
         g_free(inImg.buffer);
+        ufraw_timing_end(TIMING_TCA, 2 * size);
     }
 #endif
 }
@@ -1328,9 +1451,17 @@ static void ufraw_convert_image_first(ufraw_data *uf, UFRawPhase phase)
     raw->raw.image = (dcraw_image_type *)in->buffer;
     ufraw_convertshrink(uf, &final);
     raw->raw.image = rawimage;
+    ufraw_timing_begin(TIMING_RESIZE);
     dcraw_flip_image(&final, uf->conf->orientation);
+    ufraw_timing_end(TIMING_RESIZE, (size_t)final.height * final.width *
+                     sizeof(dcraw_image_type));
     /* The threshold is scaled for compatibility */
-    if (uf->IsXTrans) dcraw_wavelet_denoise_shrinked(&final, uf->conf->threshold * sqrt(uf->raw_multiplier));
+    if (uf->IsXTrans) {
+        ufraw_timing_begin(TIMING_DENOISE);
+        dcraw_wavelet_denoise_shrinked(&final, uf->conf->threshold * sqrt(uf->raw_multiplier));
+        ufraw_timing_end(TIMING_DENOISE, (size_t)final.height *
+                         final.width * sizeof(dcraw_image_type));
+    }
 
     // The 'out' image contains the predicted image dimensions.
     // We want to be sure that our predictions were correct.
@@ -1420,19 +1551,6 @@ static void ufraw_convert_image_tca(ufraw_data *uf, ufraw_image_data *img,
 }
 #endif // HAVE_LENSFUN
 
-static void ufraw_convert_import_buffer(ufraw_data *uf, UFRawPhase phase,
-                                        dcraw_image_data *dcimg)
-{
-    ufraw_image_data *img = &uf->Images[phase];
-
-    img->height = dcimg->height;
-    img->width = dcimg->width;
-    img->depth = sizeof(dcraw_image_type);
-    img->rowstride = img->width * img->depth;
-    g_free(img->buffer);
-    img->buffer = g_memdup(dcimg->image, img->height * img->rowstride);
-}
-
 static void ufraw_image_init(ufraw_image_data *img,
                              int width, int height, int bitdepth)
 {
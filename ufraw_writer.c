@@ -50,7 +50,12 @@
 static void grayscale_buffer(void *graybuf, int width, int bitDepth)
 {
     int i;
-    if (bitDepth > 8) {
+    if (bitDepth == 32) {
+        float *pixbuf32 = graybuf;
+        float *graybuf32 = graybuf;
+        for (i = 0; i < width; ++i, ++graybuf32, pixbuf32 += 3)
+            * graybuf32 = pixbuf32[1];
+    } else if (bitDepth > 8) {
         guint16 *pixbuf16 = graybuf;
         guint16 *graybuf16 = graybuf;
         for (i = 0; i < width; ++i, ++graybuf16, pixbuf16 += 3)
@@ -86,28 +91,36 @@ static int ppm_row_writer(ufraw_data *uf, void *volatile out, void *pixbuf,
 }
 
 #ifdef HAVE_LIBTIFF
-// There seem to be no way to get the libtiff message without a static variable
-// Therefore the folloing code is not thread-safe.
-static char ufraw_tiff_message[max_path];
-
+// libtiff has only process wide message handlers. The handler runs on the
+// thread which called libtiff, so the message is kept in its context.
 static void tiff_messenger(const char *module, const char *fmt, va_list ap)
 {
     (void)module;
-    vsnprintf(ufraw_tiff_message, max_path, fmt, ap);
+    vsnprintf(ufraw_context_current()->tiffMessage, max_path, fmt, ap);
+}
+
+static void tiff_messenger_init(void)
+{
+    static gsize done = 0;
+    if (g_once_init_enter(&done)) {
+        TIFFSetErrorHandler(tiff_messenger);
+        TIFFSetWarningHandler(tiff_messenger);
+        g_once_init_leave(&done, 1);
+    }
 }
 
 int tiff_row_writer(ufraw_data *uf, void *volatile out, void *pixbuf,
                     int row, int width, int height, int grayscale, int bitDepth)
 {
     (void)grayscale;
-    int rowStride = width * (bitDepth > 8 ? 6 : 3);
+    int rowStride = width * 3 * ((bitDepth + 7) / 8);
     int i;
     for (i = 0; i < height; i++) {
         if (TIFFWriteScanline(out, pixbuf + i * rowStride, row + i, 0) < 0) {
             // 'errno' does seem to contain useful information
             ufraw_set_error(uf, _("Error creating file."));
-            ufraw_set_error(uf, ufraw_tiff_message);
-            ufraw_tiff_message[0] = '\0';
+            ufraw_set_error(uf, ufraw_context_current()->tiffMessage);
+            ufraw_context_current()->tiffMessage[0] = '\0';
             return UFRAW_ERROR;
         }
     }
@@ -217,6 +230,22 @@ static struct tm *localtime_r(const time_t *timep, struct tm *result)
 }
 #endif /*HAVE_LIBCFITSIO && _WIN32*/
 
+#ifdef HAVE_LIBCFITSIO
+/* Write a data value key in the type of the image */
+static void fits_update_data_key(fitsfile *fitsFile, gboolean floatImage,
+                                 char *key, double value, char *comment,
+                                 int *status)
+{
+    if (floatImage) {
+        float floatValue = value;
+        fits_update_key(fitsFile, TFLOAT, key, &floatValue, comment, status);
+    } else {
+        guint16 ushortValue = value;
+        fits_update_key(fitsFile, TUSHORT, key, &ushortValue, comment, status);
+    }
+}
+#endif /*HAVE_LIBCFITSIO*/
+
 void ufraw_write_image_data(
     ufraw_data *uf, void * volatile out,
     const UFRectangle *Crop, int bitDepth, int grayscaleMode,
@@ -227,12 +256,15 @@ void ufraw_write_image_data(
     ufraw_image_type *rawImage =
         (ufraw_image_type *)uf->Images[ufraw_first_phase].buffer;
     int byteDepth = (bitDepth + 7) / 8;
-    guint8 *pixbuf8 = g_new(guint8,
-                            Crop->width * 3 * byteDepth * DEVELOP_BATCH);
+    size_t pixbufSize = Crop->width * 3 * byteDepth * DEVELOP_BATCH;
+    guint8 *pixbuf8 = g_new(guint8, pixbufSize);
+    size_t imageSize = (size_t)uf->Images[ufraw_first_phase].height *
+                       uf->Images[ufraw_first_phase].rowstride;
 
     progress(PROGRESS_SAVE, -Crop->height);
     for (row0 = 0; row0 < Crop->height; row0 += DEVELOP_BATCH) {
         progress(PROGRESS_SAVE, DEVELOP_BATCH);
+        ufraw_timing_begin(TIMING_DEVELOP);
 #ifdef _OPENMP
         #pragma omp parallel for default(shared) private(row)
 #endif
@@ -240,20 +272,69 @@ void ufraw_write_image_data(
             if (row + row0 >= Crop->height)
                 continue;
             guint8 *rowbuf = &pixbuf8[row * Crop->width * 3 * byteDepth];
-            develop(rowbuf, rawImage[(Crop->y + row + row0)*rowStride + Crop->x],
-                    uf->developer, bitDepth, Crop->width);
+            guint16 *pix = rawImage[(Crop->y + row + row0) * rowStride + Crop->x];
+            if (bitDepth == 32)
+                develop_float((float *)rowbuf, pix, uf->developer, Crop->width);
+            else
+                develop(rowbuf, pix, uf->developer, bitDepth, Crop->width);
             if (grayscaleMode)
                 grayscale_buffer(rowbuf, Crop->width, bitDepth);
         }
+        ufraw_timing_end(TIMING_DEVELOP, imageSize + pixbufSize);
         int batchHeight = MIN(Crop->height - row0, DEVELOP_BATCH);
-        if (row_writer(uf, out, pixbuf8, row0, Crop->width, batchHeight,
-                       grayscaleMode, bitDepth) != UFRAW_SUCCESS)
+        ufraw_timing_begin(TIMING_ENCODE);
+        int status = row_writer(uf, out, pixbuf8, row0, Crop->width,
+                                batchHeight, grayscaleMode, bitDepth);
+        ufraw_timing_end(TIMING_ENCODE, pixbufSize);
+        if (status != UFRAW_SUCCESS)
             break;
     }
     g_free(pixbuf8);
 }
 
+static int ufraw_do_write_image(ufraw_data *uf, gboolean convert);
+
+#if defined(HAVE_LIBTIFF) || defined(HAVE_LIBJPEG) || defined(HAVE_LIBPNG)
+/* Get the output profile to embed in the image from the profile registry.
+ * Returns NULL if the internal sRGB should not be embedded, or if the
+ * profile can not be read, in which case a warning is set. The profile
+ * is released with uf_colorspaces_release_profile(). */
+static const uf_profile *ufraw_output_profile(ufraw_data *uf)
+{
+    const char *file = uf->developer->profileFile[out_profile];
+    /* Embed output profile if it is not the internal sRGB. */
+    if (strcmp(file, "") == 0 && uf->conf->profileIndex[out_profile] != 1)
+        return NULL;
+    const uf_profile *profile = uf_colorspaces_get_profile(file);
+    if (profile == NULL)
+        ufraw_set_warning(uf,
+                          _("Failed to embed output profile '%s' in '%s'."),
+                          strcmp(file, "") ? file : uf->conf->profile[out_profile]
+                          [uf->conf->profileIndex[out_profile]].name,
+                          uf->conf->outputFilename);
+    return profile;
+}
+#endif
+
 int ufraw_write_image(ufraw_data *uf)
+{
+    ufraw_context *prev = ufraw_context_set(uf->context);
+    int status = ufraw_do_write_image(uf, TRUE);
+    ufraw_context_set(prev);
+    return status;
+}
+
+/* Same as ufraw_write_image(), for an image which was already developed
+ * by ufraw_convert_image() with the current settings. */
+int ufraw_write_converted_image(ufraw_data *uf)
+{
+    ufraw_context *prev = ufraw_context_set(uf->context);
+    int status = ufraw_do_write_image(uf, FALSE);
+    ufraw_context_set(prev);
+    return status;
+}
+
+static int ufraw_do_write_image(ufraw_data *uf, gboolean convert)
 {
     /* 'volatile' supresses clobbering warning */
     void * volatile out; /* out is a pointer to FILE or TIFF */
@@ -289,9 +370,8 @@ int ufraw_write_image(ufraw_data *uf)
     }
 #ifdef HAVE_LIBTIFF
     if (uf->conf->type == tiff_type) {
-        TIFFSetErrorHandler(tiff_messenger);
-        TIFFSetWarningHandler(tiff_messenger);
-        ufraw_tiff_message[0] = '\0';
+        tiff_messenger_init();
+        ufraw_context_current()->tiffMessage[0] = '\0';
         if (!strcmp(uf->conf->outputFilename, "-")) {
             out = TIFFFdOpen(fileno((FILE *)stdout),
                              uf->conf->outputFilename, "w");
@@ -303,9 +383,9 @@ int ufraw_write_image(ufraw_data *uf)
         }
         if (out == NULL) {
             ufraw_set_error(uf, _("Error creating file."));
-            ufraw_set_error(uf, ufraw_tiff_message);
+            ufraw_set_error(uf, ufraw_context_current()->tiffMessage);
             ufraw_set_error(uf, g_strerror(errno));
-            ufraw_tiff_message[0] = '\0';
+            ufraw_context_current()->tiffMessage[0] = '\0';
             return ufraw_get_status(uf);
         }
     } else
@@ -358,12 +438,34 @@ int ufraw_write_image(ufraw_data *uf)
             }
         }
     // TODO: error handling
-    ufraw_convert_image(uf);
+    if (convert)
+        ufraw_convert_image(uf);
     UFRectangle Crop;
     ufraw_get_scaled_crop(uf, &Crop);
     volatile int BitDepth = uf->conf->profile[out_profile]
                             [uf->conf->profileIndex[out_profile]].BitDepth;
-    if (BitDepth != 16) BitDepth = 8;
+    /* Float output is only supported by TIFF and FITS */
+    if (BitDepth == 32 && uf->conf->type != tiff_type &&
+            uf->conf->type != fits_type) {
+        ufraw_set_warning(uf,
+                          _("32 bit depth is only supported for TIFF and "
+                            "FITS output, writing 16 bit output."));
+        BitDepth = 16;
+    }
+    if (BitDepth != 16 && BitDepth != 32) BitDepth = 8;
+    /* Float TIFF output is only transformed between matrix-shaper profiles.
+     * Otherwise it would be in the input color space, so write 16 bit.
+     * FITS output is never transformed, neither with 16 bit. */
+    if (BitDepth == 32 && uf->conf->type == tiff_type &&
+            uf->developer->floatTransform == NULL) {
+        ufraw_set_warning(uf,
+                          _("Float output requires matrix-shaper input and "
+                            "output profiles, writing 16 bit output."));
+        BitDepth = 16;
+    }
+    /* develop_float() does no grayscale conversion */
+    if (BitDepth == 32)
+        grayscaleMode = uf->colors == 1;
     if (uf->conf->type == ppm_type && BitDepth == 8) {
         fprintf(out, "P%c\n%d %d\n%d\n",
                 grayscaleMode ? '5' : '6', Crop.width, Crop.height, 0xFF);
@@ -381,6 +483,8 @@ int ufraw_write_image(ufraw_data *uf)
         TIFFSetField(out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
         TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, grayscaleMode ? 1 : 3);
         TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, BitDepth);
+        if (BitDepth == 32)
+            TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_IEEEFP);
         TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
         TIFFSetField(out, TIFFTAG_PHOTOMETRIC, grayscaleMode
                      ? PHOTOMETRIC_MINISBLACK : PHOTOMETRIC_RGB);
@@ -388,41 +492,20 @@ int ufraw_write_image(ufraw_data *uf)
         if (uf->conf->losslessCompress) {
             TIFFSetField(out, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE);
             TIFFSetField(out, TIFFTAG_ZIPQUALITY, 9);
-            TIFFSetField(out, TIFFTAG_PREDICTOR, 2);
+            TIFFSetField(out, TIFFTAG_PREDICTOR, BitDepth == 32 ?
+                         PREDICTOR_FLOATINGPOINT : PREDICTOR_HORIZONTAL);
         } else
 #endif
             TIFFSetField(out, TIFFTAG_COMPRESSION, COMPRESSION_NONE);
-        /* Embed output profile if it is not the internal sRGB. */
-        if (strcmp(uf->developer->profileFile[out_profile], "")) {
-            char *buf;
-            gsize len;
-            if (g_file_get_contents(uf->developer->profileFile[out_profile],
-                                    &buf, &len, NULL)) {
-                TIFFSetField(out, TIFFTAG_ICCPROFILE, len, buf);
-                g_free(buf);
-            } else {
-                ufraw_set_warning(uf,
-                                  _("Failed to embed output profile '%s' in '%s'."),
-                                  uf->developer->profileFile[out_profile],
-                                  uf->conf->outputFilename);
-            }
-        } else if (uf->conf->profileIndex[out_profile] == 1) { // Embed sRGB.
-            cmsHPROFILE hOutProfile = uf_colorspaces_create_srgb_profile();
-            cmsUInt32Number len = 0;
-            cmsSaveProfileToMem(hOutProfile, 0, &len); // Calculate len.
-            if (len > 0) {
-                unsigned char buf[len];
-                cmsSaveProfileToMem(hOutProfile, buf, &len);
-                TIFFSetField(out, TIFFTAG_ICCPROFILE, len, buf);
-            } else {
-                ufraw_set_warning(uf,
-                                  _("Failed to embed output profile '%s' in '%s'."),
-                                  uf->conf->profile[out_profile]
-                                  [uf->conf->profileIndex[out_profile]].name,
-                                  uf->conf->outputFilename);
-            }
-            cmsCloseProfile(hOutProfile);
-        }
+        /* Float output is in linear light, without the tone curves of the
+         * output profile. */
+        const uf_profile *profile = BitDepth == 32 ?
+                                    uf_colorspaces_get_linear_profile(
+                                        uf->developer->profile[out_profile]) :
+                                    ufraw_output_profile(uf);
+        if (profile != NULL)
+            TIFFSetField(out, TIFFTAG_ICCPROFILE, profile->size, profile->data);
+        uf_colorspaces_release_profile(profile);
         TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(out, 0));
 
         ufraw_write_image_data(uf, out, &Crop, BitDepth, grayscaleMode,
@@ -465,37 +548,11 @@ int ufraw_write_image(ufraw_data *uf)
 
         jpeg_start_compress(&cinfo, TRUE);
 
-        /* Embed output profile if it is not the internal sRGB. */
-        if (strcmp(uf->developer->profileFile[out_profile], "")) {
-            char *buf;
-            gsize len;
-            if (g_file_get_contents(uf->developer->profileFile[out_profile],
-                                    &buf, &len, NULL)) {
-                write_icc_profile(&cinfo, (unsigned char *)buf, len);
-                g_free(buf);
-            } else {
-                ufraw_set_warning(uf,
-                                  _("Failed to embed output profile '%s' in '%s'."),
-                                  uf->developer->profileFile[out_profile],
-                                  uf->conf->outputFilename);
-            }
-        } else if (uf->conf->profileIndex[out_profile] == 1) { // Embed sRGB.
-            cmsHPROFILE hOutProfile = uf_colorspaces_create_srgb_profile();
-            cmsUInt32Number len = 0;
-            cmsSaveProfileToMem(hOutProfile, 0, &len); // Calculate len.
-            if (len > 0) {
-                unsigned char buf[len];
-                cmsSaveProfileToMem(hOutProfile, buf, &len);
-                write_icc_profile(&cinfo, buf, len);
-            } else {
-                ufraw_set_warning(uf,
-                                  _("Failed to embed output profile '%s' in '%s'."),
-                                  uf->conf->profile[out_profile]
-                                  [uf->conf->profileIndex[out_profile]].name,
-                                  uf->conf->outputFilename);
-            }
-            cmsCloseProfile(hOutProfile);
-        }
+        const uf_profile *profile = ufraw_output_profile(uf);
+        if (profile != NULL)
+            write_icc_profile(&cinfo, (const JOCTET *)profile->data,
+                              profile->size);
+        uf_colorspaces_release_profile(profile);
         if (uf->conf->embedExif) {
             ufraw_exif_prepare_output(uf);
             if (uf->outputExifBuf != NULL) {
@@ -554,44 +611,16 @@ int ufraw_write_image(ufraw_data *uf)
                                            uf->conf->make, uf->conf->model);
             png_set_text(png, info, text, 2);
             g_free(text[1].text);
-            /* Embed output profile if it is not the internal sRGB. */
-            if (strcmp(uf->developer->profileFile[out_profile], "")) {
-                char *buf;
-                gsize len;
-                if (g_file_get_contents(uf->developer->profileFile[out_profile],
-                                        &buf, &len, NULL)) {
-                    png_set_iCCP(png, info,
-                                 uf->developer->profileFile[out_profile],
-                                 PNG_COMPRESSION_TYPE_BASE,
-                                 (png_const_bytep) buf, len);
-                    g_free(buf);
-                } else {
-                    ufraw_set_warning(uf,
-                                      _("Failed to embed output profile '%s' in '%s'."),
-                                      uf->developer->profileFile[out_profile],
-                                      uf->conf->outputFilename);
-                }
-            } else if (uf->conf->profileIndex[out_profile] == 1) { // Embed sRGB.
-                cmsHPROFILE hOutProfile = uf_colorspaces_create_srgb_profile();
-                cmsUInt32Number len = 0;
-                cmsSaveProfileToMem(hOutProfile, 0, &len); // Calculate len.
-                if (len > 0) {
-                    char buf[len];
-                    cmsSaveProfileToMem(hOutProfile, buf, &len);
-                    png_set_iCCP(png, info,
-                                 uf->conf->profile[out_profile]
-                                 [uf->conf->profileIndex[out_profile]].name,
-                                 PNG_COMPRESSION_TYPE_BASE,
-                                 (png_const_bytep) buf, len);
-                } else {
-                    ufraw_set_warning(uf,
-                                      _("Failed to embed output profile '%s' in '%s'."),
-                                      uf->conf->profile[out_profile]
-                                      [uf->conf->profileIndex[out_profile]].name,
-                                      uf->conf->outputFilename);
-                }
-                cmsCloseProfile(hOutProfile);
-            }
+            const uf_profile *profile = ufraw_output_profile(uf);
+            if (profile != NULL)
+                png_set_iCCP(png, info,
+                             strcmp(uf->developer->profileFile[out_profile], "")
+                             ? uf->developer->profileFile[out_profile]
+                             : uf->conf->profile[out_profile]
+                             [uf->conf->profileIndex[out_profile]].name,
+                             PNG_COMPRESSION_TYPE_BASE,
+                             (png_const_bytep) profile->data, profile->size);
+            uf_colorspaces_release_profile(profile);
             if (uf->conf->embedExif) {
                 ufraw_exif_prepare_output(uf);
                 if (uf->outputExifBuf != NULL)
@@ -613,12 +642,14 @@ int ufraw_write_image(ufraw_data *uf)
     } else if (uf->conf->type == fits_type) {
 
         // image data and min/max values
-        guint16 *image;
-        guint16 max[3] = { 0, 0, 0 }, min[3] = { 65535, 65535, 65535 };
-        guint64 sum[3] = { 0, 0, 0 };
+        gboolean floatImage = BitDepth == 32;
+        guint16 *image = NULL;
+        float *imageFloat = NULL;
+        double max[3] = { 0, 0, 0 }, min[3] = { 65535, 65535, 65535 };
+        double sum[3] = { 0, 0, 0 };
 
         // FITS Header (taken from cookbook.c)
-        int bitpix = USHORT_IMG;    // Use float format
+        int bitpix = floatImage ? FLOAT_IMG : USHORT_IMG;
         int naxis  = 3;		    // 3-dimensional image
         int status = 0;		    // status variable for fitsio
 
@@ -626,7 +657,12 @@ int ufraw_write_image(ufraw_data *uf)
         long dim = Crop.width * Crop.height;
         long offset = 0;
 
-        image = g_new(guint16, 3 * dim);
+        if (floatImage) {
+            imageFloat = g_new(float, 3 * dim);
+            min[0] = min[1] = min[2] = G_MAXFLOAT;
+        } else {
+            image = g_new(guint16, 3 * dim);
+        }
 
         int row;
         int i;
@@ -634,18 +670,33 @@ int ufraw_write_image(ufraw_data *uf)
             (ufraw_image_type *)uf->Images[ufraw_first_phase].buffer;
         int rowStride = uf->Images[ufraw_first_phase].width;
         guint16 pixbuf16[3];
+        float *rowFloat = floatImage ? g_new(float, 3 * Crop.width) : NULL;
 
         // Avoid FITS images being saved upside down
         ufraw_flip_image(uf, 2);
 
+        ufraw_timing_begin(TIMING_DEVELOP);
         progress(PROGRESS_SAVE, -Crop.height);
         for (row = 0; row < Crop.height; row++) {
             progress(PROGRESS_SAVE, 1);
+            if (floatImage)
+                develop_float(rowFloat,
+                              rawImage[(Crop.y + row) * rowStride + Crop.x],
+                              uf->developer, Crop.width);
             for (i = 0; i < Crop.width; i++) {
                 offset = row * Crop.width + i;
+                int c;
+                if (floatImage) {
+                    for (c = 0; c < 3; c++) {
+                        float value = rowFloat[3 * i + c];
+                        sum[c] += imageFloat[c * dim + offset] = value;
+                        max[c] = MAX(value, max[c]);
+                        min[c] = MIN(value, min[c]);
+                    }
+                    continue;
+                }
                 develop_linear(rawImage[(Crop.y + row)*rowStride + Crop.x + i], pixbuf16,
                                uf->developer);
-                int c;
                 for (c = 0; c < 3; c++) {
                     sum[c] += image[c * dim + offset] = pixbuf16[c];
                     max[c] = MAX(pixbuf16[c], max[c]);
@@ -653,39 +704,46 @@ int ufraw_write_image(ufraw_data *uf)
                 }
             }
         }
+        g_free(rowFloat);
+        ufraw_timing_end(TIMING_DEVELOP,
+                         3 * dim * (floatImage ? sizeof(float) : sizeof(guint16)));
         // calculate averages
         float average[3];
         int c;
         for (c = 0; c < 3; c++)
-            average[c] = (float)sum[c] / dim;
+            average[c] = sum[c] / dim;
 
-        guint16 maxAll = MAX(MAX(max[0], max[1]), max[2]);
-        guint16 minAll = MIN(MIN(min[0], min[1]), min[2]);
+        double maxAll = MAX(MAX(max[0], max[1]), max[2]);
+        double minAll = MIN(MIN(min[0], min[1]), min[2]);
 
         fits_create_img(fitsFile, bitpix, naxis, naxes, &status);
 
-        fits_write_img(fitsFile, TUSHORT, 1, 3 * dim, image, &status);
+        if (floatImage)
+            fits_write_img(fitsFile, TFLOAT, 1, 3 * dim, imageFloat, &status);
+        else
+            fits_write_img(fitsFile, TUSHORT, 1, 3 * dim, image, &status);
         g_free(image);
+        g_free(imageFloat);
 
-        fits_update_key(fitsFile, TUSHORT, "DATAMIN", &minAll,
-                        "minimum data (overall)", &status);
-        fits_update_key(fitsFile, TUSHORT, "DATAMAX", &maxAll,
-                        "maximum data (overall)", &status);
+        fits_update_data_key(fitsFile, floatImage, "DATAMIN", minAll,
+                             "minimum data (overall)", &status);
+        fits_update_data_key(fitsFile, floatImage, "DATAMAX", maxAll,
+                             "maximum data (overall)", &status);
 
-        fits_update_key(fitsFile, TUSHORT, "DATAMINR", &min[0],
-                        "minimum data (red channel)", &status);
-        fits_update_key(fitsFile, TUSHORT, "DATAMAXR", &max[0],
-                        "maximum data (red channel)", &status);
+        fits_update_data_key(fitsFile, floatImage, "DATAMINR", min[0],
+                             "minimum data (red channel)", &status);
+        fits_update_data_key(fitsFile, floatImage, "DATAMAXR", max[0],
+                             "maximum data (red channel)", &status);
 
-        fits_update_key(fitsFile, TUSHORT, "DATAMING", &min[1],
-                        "minimum data (green channel)", &status);
-        fits_update_key(fitsFile, TUSHORT, "DATAMAXG", &max[1],
-                        "maximum data (green channel)", &status);
+        fits_update_data_key(fitsFile, floatImage, "DATAMING", min[1],
+                             "minimum data (green channel)", &status);
+        fits_update_data_key(fitsFile, floatImage, "DATAMAXG", max[1],
+                             "maximum data (green channel)", &status);
 
-        fits_update_key(fitsFile, TUSHORT, "DATAMINB", &min[2],
-                        "minimum data (blue channel)", &status);
-        fits_update_key(fitsFile, TUSHORT, "DATAMAXB", &max[2],
-                        "maximum data (blue channel)", &status);
+        fits_update_data_key(fitsFile, floatImage, "DATAMINB", min[2],
+                             "minimum data (blue channel)", &status);
+        fits_update_data_key(fitsFile, floatImage, "DATAMAXB", max[2],
+                             "maximum data (blue channel)", &status);
 
         fits_update_key(fitsFile, TFLOAT, "AVERAGER", &average[0],
                         "average (red channel)", &status);
@@ -768,12 +826,12 @@ int ufraw_write_image(ufraw_data *uf)
 #ifdef HAVE_LIBTIFF
     if (uf->conf->type == tiff_type) {
         TIFFClose(out);
-        if (ufraw_tiff_message[0] != '\0') {
+        if (ufraw_context_current()->tiffMessage[0] != '\0') {
             if (!ufraw_is_error(uf)) {   // Error was not already set before
                 ufraw_set_error(uf, _("Error creating file."));
-                ufraw_set_error(uf, ufraw_tiff_message);
+                ufraw_set_error(uf, ufraw_context_current()->tiffMessage);
             }
-            ufraw_tiff_message[0] = '\0';
+            ufraw_context_current()->tiffMessage[0] = '\0';
         } else {
             if (uf->conf->embedExif)
                 ufraw_exif_write(uf);